@@ -0,0 +1,275 @@
+#include "apic.h"
+
+#include <memory/vmm.h>
+#include <system/acpi.h>
+#include <utils/debug.h>
+
+#include "hal.h"
+#include "idt.h"
+#include "pic.h"
+
+#define ISA_IRQS 16
+
+extern void apic_spurious_irq();
+
+struct isa_irq
+{
+	uint32_t gsi;
+	uint32_t flags;	 // IOAPIC_POLARITY_LOW | IOAPIC_TRIGGER_LEVEL
+};
+
+static volatile uint32_t *lapic_base;
+static volatile uint32_t *ioapic_base;
+static uint32_t ioapic_gsi_base, ioapic_gsi_count;
+static uint32_t lapic_id;
+static bool x2apic_mode, apic_active;
+static struct isa_irq isa_irqs[ISA_IRQS];
+
+static uint32_t lapic_read(uint32_t reg)
+{
+	if (x2apic_mode)
+		return rdmsr(X2APIC_MSR_BASE + (reg >> 4));
+	return lapic_base[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value)
+{
+	if (x2apic_mode)
+		wrmsr(X2APIC_MSR_BASE + (reg >> 4), value);
+	else
+		lapic_base[reg / 4] = value;
+}
+
+static uint32_t ioapic_read(uint32_t reg)
+{
+	ioapic_base[IOAPIC_REGSEL / 4] = reg;
+	return ioapic_base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value)
+{
+	ioapic_base[IOAPIC_REGSEL / 4] = reg;
+	ioapic_base[IOAPIC_WINDOW / 4] = value;
+}
+
+static void ioapic_set_entry(uint32_t gsi, uint32_t low, uint32_t high)
+{
+	uint32_t reg = IOAPIC_REG_REDIRECTION + (gsi - ioapic_gsi_base) * 2;
+
+	// keep the entry masked while it is half written
+	ioapic_write(reg, IOAPIC_MASKED);
+	ioapic_write(reg + 1, high);
+	ioapic_write(reg, low);
+}
+
+static bool apic_parse_madt(uint32_t *lapic_paddr, uint32_t *ioapic_paddr)
+{
+	struct acpi_madt *madt = (struct acpi_madt *)acpi_find_table("APIC");
+	if (!madt)
+		return false;
+
+	*lapic_paddr = madt->lapic_address;
+	*ioapic_paddr = 0;
+
+	// ISA irqs are identity mapped, edge triggered and active high unless overridden
+	for (uint32_t i = 0; i < ISA_IRQS; ++i)
+		isa_irqs[i] = (struct isa_irq){.gsi = i, .flags = 0};
+
+	uint8_t *iter = madt->entries;
+	uint8_t *end = (uint8_t *)madt + madt->header.length;
+	while (iter + sizeof(struct acpi_madt_entry) <= end)
+	{
+		struct acpi_madt_entry *entry = (struct acpi_madt_entry *)iter;
+		if (entry->length < sizeof(struct acpi_madt_entry))
+			break;
+
+		switch (entry->type)
+		{
+		case ACPI_MADT_IOAPIC:
+		{
+			// NOTE: Only the first ioapic is used, which covers the ISA irqs on every
+			// machine we care about
+			struct acpi_madt_ioapic *ioapic = (struct acpi_madt_ioapic *)entry;
+			if (!*ioapic_paddr)
+			{
+				*ioapic_paddr = ioapic->address;
+				ioapic_gsi_base = ioapic->gsi_base;
+			}
+			break;
+		}
+		case ACPI_MADT_INTERRUPT_OVERRIDE:
+		{
+			struct acpi_madt_interrupt_override *override = (struct acpi_madt_interrupt_override *)entry;
+			if (override->bus != 0 || override->source >= ISA_IRQS)
+				break;
+
+			struct isa_irq *irq = &isa_irqs[override->source];
+			irq->gsi = override->gsi;
+			irq->flags = 0;
+			if ((override->flags & ACPI_MADT_POLARITY_MASK) == ACPI_MADT_POLARITY_ACTIVE_LOW)
+				irq->flags |= IOAPIC_POLARITY_LOW;
+			if ((override->flags & ACPI_MADT_TRIGGER_MASK) == ACPI_MADT_TRIGGER_LEVEL)
+				irq->flags |= IOAPIC_TRIGGER_LEVEL;
+			break;
+		}
+		case ACPI_MADT_LAPIC_ADDRESS_OVERRIDE:
+		{
+			struct acpi_madt_lapic_address_override *override = (struct acpi_madt_lapic_address_override *)entry;
+			if (!(override->address >> 32))
+				*lapic_paddr = override->address;
+			break;
+		}
+		}
+		iter += entry->length;
+	}
+
+	return *ioapic_paddr != 0;
+}
+
+static void lapic_init(uint32_t lapic_paddr)
+{
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+
+	// NOTE: A disabled apic can't go straight to x2APIC, the SDM wants xAPIC mode enabled first
+	uint64_t base = rdmsr(IA32_APIC_BASE_MSR) | IA32_APIC_BASE_ENABLE;
+	wrmsr(IA32_APIC_BASE_MSR, base);
+
+	x2apic_mode = ecx & (1 << 21);
+	if (x2apic_mode)
+		wrmsr(IA32_APIC_BASE_MSR, base | IA32_APIC_BASE_X2APIC);
+	else
+		lapic_base = ioremap(lapic_paddr, PMM_FRAME_SIZE);
+
+	lapic_id = x2apic_mode ? lapic_read(LAPIC_ID) : lapic_read(LAPIC_ID) >> 24;
+
+	// legacy wires stay quiet, everything comes through the ioapic
+	lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+
+	apic_set_priority(0);
+	lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+
+	// clear anything latched before the apic was enabled
+	lapic_write(LAPIC_EOI, 0);
+}
+
+static void ioapic_init(uint32_t ioapic_paddr)
+{
+	ioapic_base = ioremap(ioapic_paddr, PMM_FRAME_SIZE);
+	ioapic_gsi_count = ((ioapic_read(IOAPIC_REG_VERSION) >> 16) & 0xff) + 1;
+
+	for (uint32_t i = 0; i < ioapic_gsi_count; ++i)
+		ioapic_set_entry(ioapic_gsi_base + i, IOAPIC_MASKED, 0);
+}
+
+// an override can move another ISA irq onto this line's identity gsi (IRQ0 -> GSI2 is the usual one),
+// the pin then belongs to the overridden irq
+static bool isa_irq_gsi_claimed(uint8_t irq_line)
+{
+	for (uint32_t i = 0; i < ISA_IRQS; ++i)
+		if (i != irq_line && isa_irqs[i].gsi != i && isa_irqs[i].gsi == isa_irqs[irq_line].gsi)
+			return true;
+	return false;
+}
+
+// NOTE: ISA irq n keeps vector IRQ0 + n, so handlers registered against the pic vectors
+// keep working. Entries start masked, drivers unmask their line with irq_clear_mask
+static void ioapic_route_isa_irq(uint8_t irq_line, bool masked)
+{
+	struct isa_irq *irq = &isa_irqs[irq_line];
+	if (irq->gsi < ioapic_gsi_base || irq->gsi >= ioapic_gsi_base + ioapic_gsi_count ||
+		isa_irq_gsi_claimed(irq_line))
+		return;
+
+	uint32_t high = x2apic_mode ? lapic_id : lapic_id << 24;
+	ioapic_set_entry(irq->gsi, (IRQ0 + irq_line) | irq->flags | (masked ? IOAPIC_MASKED : 0), high);
+}
+
+// route a gsi which isn't used by an ISA irq straight to a vector, for devices like the hpet
+bool ioapic_route_gsi(uint32_t gsi, uint8_t vector, uint32_t flags)
+{
+	if (!apic_active || gsi < ioapic_gsi_base || gsi >= ioapic_gsi_base + ioapic_gsi_count)
+		return false;
+
+	for (uint32_t i = 0; i < ISA_IRQS; ++i)
+		if (isa_irqs[i].gsi == gsi)
+			return false;
+
+	uint32_t high = x2apic_mode ? lapic_id : lapic_id << 24;
+	ioapic_set_entry(gsi, vector | flags, high);
+	return true;
+}
+
+bool apic_init()
+{
+	serial_write("APIC: Initializing\n");
+
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+
+	uint32_t lapic_paddr, ioapic_paddr;
+	if (!(edx & (1 << 9)) || !apic_parse_madt(&lapic_paddr, &ioapic_paddr))
+	{
+		serial_write("APIC: Not available, staying on PIC\n");
+		return false;
+	}
+
+	setvect(APIC_SPURIOUS_VECTOR, (I86_IVT)apic_spurious_irq);
+
+	uint32_t flags = local_irq_save();
+
+	// mask every pic line, irq_ack must not touch the 8259 from now on
+	outportb(PIC1_DATA, 0xff);
+	outportb(PIC2_DATA, 0xff);
+
+	lapic_init(lapic_paddr);
+	ioapic_init(ioapic_paddr);
+	for (uint8_t i = 0; i < ISA_IRQS; ++i)
+		ioapic_route_isa_irq(i, true);
+	apic_active = true;
+
+	local_irq_restore(flags);
+
+	serial_write(x2apic_mode ? "APIC: x2APIC mode\n" : "APIC: xAPIC mode\n");
+	serial_write("APIC: Done\n");
+	return true;
+}
+
+bool apic_enabled()
+{
+	return apic_active;
+}
+
+void apic_eoi()
+{
+	if (x2apic_mode)
+		wrmsr(X2APIC_MSR_BASE + (LAPIC_EOI >> 4), 0);
+	else
+		lapic_base[LAPIC_EOI / 4] = 0;
+}
+
+// interrupts with a priority class (vector >> 4) lower or equal to priority are held back
+void apic_set_priority(uint8_t priority)
+{
+	lapic_write(LAPIC_TPR, (priority & 0xf) << 4);
+}
+
+uint8_t apic_get_priority()
+{
+	return (lapic_read(LAPIC_TPR) >> 4) & 0xf;
+}
+
+void ioapic_set_mask(uint8_t irq_line)
+{
+	if (irq_line < ISA_IRQS)
+		ioapic_route_isa_irq(irq_line, true);
+}
+
+void ioapic_clear_mask(uint8_t irq_line)
+{
+	if (irq_line < ISA_IRQS)
+		ioapic_route_isa_irq(irq_line, false);
+}
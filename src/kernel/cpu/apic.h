@@ -0,0 +1,46 @@
+#ifndef CPU_APIC_H
+#define CPU_APIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+// local apic registers (offsets in xapic mode, msr = 0x800 + offset / 16 in x2apic mode)
+#define LAPIC_ID 0x20
+#define LAPIC_VERSION 0x30
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define IA32_APIC_BASE_ENABLE 0x800
+#define IA32_APIC_BASE_X2APIC 0x400
+#define X2APIC_MSR_BASE 0x800
+
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_REG_VERSION 0x01
+#define IOAPIC_REG_REDIRECTION 0x10
+
+#define IOAPIC_POLARITY_LOW 0x2000
+#define IOAPIC_TRIGGER_LEVEL 0x8000
+#define IOAPIC_MASKED 0x10000
+
+bool apic_init();
+bool apic_enabled();
+void apic_eoi();
+void apic_set_priority(uint8_t priority);
+uint8_t apic_get_priority();
+void ioapic_set_mask(uint8_t irq_line);
+void ioapic_clear_mask(uint8_t irq_line);
+bool ioapic_route_gsi(uint32_t gsi, uint8_t vector, uint32_t flags);
+
+#endif
@@ -0,0 +1,49 @@
+#include "clockevents.h"
+
+#include <utils/debug.h>
+
+#include "hal.h"
+#include "tick.h"
+
+static struct clock_event_device *best_device;
+
+void clockevents_switch_state(struct clock_event_device *dev, enum clock_event_state state)
+{
+	if (dev->state == state)
+		return;
+
+	switch (state)
+	{
+	case CLOCK_EVT_STATE_PERIODIC:
+		dev->set_state_periodic(dev);
+		break;
+	case CLOCK_EVT_STATE_ONESHOT:
+		dev->set_state_oneshot(dev);
+		break;
+	case CLOCK_EVT_STATE_SHUTDOWN:
+		dev->set_state_shutdown(dev);
+		break;
+	}
+	dev->state = state;
+}
+
+// NOTE: The device with the highest rating becomes the tick device, the one it replaces is shut down
+void clockevents_register_device(struct clock_event_device *dev)
+{
+	uint32_t flags = local_irq_save();
+
+	dev->state = CLOCK_EVT_STATE_SHUTDOWN;
+	if (!best_device || dev->rating > best_device->rating)
+	{
+		if (best_device)
+			clockevents_switch_state(best_device, CLOCK_EVT_STATE_SHUTDOWN);
+		best_device = dev;
+		tick_setup_device(dev);
+
+		serial_write("CLOCKEVENTS: Using ");
+		serial_write(dev->name);
+		serial_write("\n");
+	}
+
+	local_irq_restore(flags);
+}
@@ -0,0 +1,38 @@
+#ifndef CPU_CLOCKEVENTS_H
+#define CPU_CLOCKEVENTS_H
+
+#include <stdint.h>
+
+#define CLOCK_EVT_FEAT_PERIODIC 0x1
+#define CLOCK_EVT_FEAT_ONESHOT 0x2
+
+enum clock_event_state
+{
+	CLOCK_EVT_STATE_SHUTDOWN,
+	CLOCK_EVT_STATE_PERIODIC,
+	CLOCK_EVT_STATE_ONESHOT,
+};
+
+// a device which can raise an interrupt at a programmed time, the tick layer drives the best one
+struct clock_event_device
+{
+	const char *name;
+	uint32_t features;
+	uint32_t rating;  // higher is better
+	uint32_t min_delta_us;
+	uint32_t max_delta_us;
+	enum clock_event_state state;
+
+	void (*event_handler)(struct clock_event_device *dev);
+	int32_t (*set_next_event)(uint32_t delta_us, struct clock_event_device *dev);
+	void (*set_state_periodic)(struct clock_event_device *dev);
+	void (*set_state_oneshot)(struct clock_event_device *dev);
+	void (*set_state_shutdown)(struct clock_event_device *dev);
+	// time since the last periodic tick or set_next_event
+	uint32_t (*get_elapsed_us)(struct clock_event_device *dev);
+};
+
+void clockevents_register_device(struct clock_event_device *dev);
+void clockevents_switch_state(struct clock_event_device *dev, enum clock_event_state state);
+
+#endif
@@ -0,0 +1,174 @@
+#include "clocksource.h"
+
+#include <include/seqlock.h>
+#include <utils/debug.h>
+#include <utils/math.h>
+
+#include "hal.h"
+#include "tick.h"
+
+/*
+  Monotonic time since boot
+  The active clocksource is read on demand and the cycles since the last update are converted with
+  mult/shift. The tick folds elapsed cycles into the base regularly so the delta (and delta * mult)
+  stays small. Fractions of a nanosecond are kept shifted, so no time is lost between updates
+  Wall time is the monotonic time plus the wall clock seconds at boot.
+  Everything is published under tk_seq: writers run with interrupts disabled, readers take a
+  snapshot and retry, so time can be read from any context without a lock or masking interrupts
+*/
+static struct timekeeper
+{
+	struct clocksource *clock;
+	uint64_t cycle_last;
+	uint64_t base_ns;
+	uint64_t base_snsec;	 // shifted nanoseconds, < 1 << clock->shift
+	uint32_t boot_seconds;	 // wall clock seconds at ktime 0
+} tk;
+static seqcount_t tk_seq = SEQCNT_ZERO;
+
+static uint64_t jiffies_read(struct clocksource *cs)
+{
+	return jiffies;
+}
+
+// NOTE: Only good to a millisecond, anything better wins
+static struct clocksource clocksource_jiffies = {
+	.name = "jiffies",
+	.rating = 1,
+	.mask = 0xffffffff,
+	.mult = NSEC_PER_MSEC,
+	.shift = 0,
+	.read = jiffies_read,
+};
+
+// NOTE: Pick the largest shift (best precision) for which converting maxsec seconds worth of
+// cycles from `from` to `to` units still fits in 64 bits
+void clocks_calc_mult_shift(uint32_t *mult, uint32_t *shift, uint32_t from, uint32_t to, uint32_t maxsec)
+{
+	uint64_t tmp;
+	uint32_t sft, sftacc = 32;
+
+	tmp = ((uint64_t)maxsec * from) >> 32;
+	while (tmp)
+	{
+		tmp >>= 1;
+		sftacc--;
+	}
+
+	for (sft = 32; sft > 0; sft--)
+	{
+		tmp = (uint64_t)to << sft;
+		tmp += from / 2;
+		tmp = div_u64(tmp, from);
+		if ((tmp >> sftacc) == 0)
+			break;
+	}
+	*mult = tmp;
+	*shift = sft;
+}
+
+// caller is inside a write section
+static void timekeeping_forward(uint64_t now)
+{
+	uint64_t delta = (now - tk.cycle_last) & tk.clock->mask;
+
+	tk.cycle_last = now;
+	tk.base_snsec += delta * tk.clock->mult;
+	tk.base_ns += tk.base_snsec >> tk.clock->shift;
+	tk.base_snsec &= ((uint64_t)1 << tk.clock->shift) - 1;
+}
+
+// called from the tick
+void timekeeping_update()
+{
+	uint32_t flags = local_irq_save();
+	write_seqcount_begin(&tk_seq);
+	timekeeping_forward(tk.clock->read(tk.clock));
+	write_seqcount_end(&tk_seq);
+	local_irq_restore(flags);
+}
+
+static uint64_t timekeeping_get_ns()
+{
+	uint64_t delta = (tk.clock->read(tk.clock) - tk.cycle_last) & tk.clock->mask;
+	return tk.base_ns + ((tk.base_snsec + delta * tk.clock->mult) >> tk.clock->shift);
+}
+
+uint64_t ktime_get_ns()
+{
+	uint32_t seq;
+	uint64_t ns;
+
+	do
+	{
+		seq = read_seqcount_begin(&tk_seq);
+		ns = timekeeping_get_ns();
+	} while (read_seqcount_retry(&tk_seq, seq));
+
+	return ns;
+}
+
+uint64_t ktime_get_real_ns()
+{
+	uint32_t seq;
+	uint64_t ns;
+
+	do
+	{
+		seq = read_seqcount_begin(&tk_seq);
+		ns = (uint64_t)tk.boot_seconds * NSEC_PER_SEC + timekeeping_get_ns();
+	} while (read_seqcount_retry(&tk_seq, seq));
+
+	return ns;
+}
+
+// step the wall clock to `seconds`, the monotonic clock is not touched
+void timekeeping_settime(uint32_t seconds)
+{
+	uint32_t flags = local_irq_save();
+	write_seqcount_begin(&tk_seq);
+	tk.boot_seconds = seconds - div_u64(timekeeping_get_ns(), NSEC_PER_SEC);
+	write_seqcount_end(&tk_seq);
+	local_irq_restore(flags);
+}
+
+void timekeeping_set_boot_seconds(uint32_t seconds)
+{
+	uint32_t flags = local_irq_save();
+	write_seqcount_begin(&tk_seq);
+	tk.boot_seconds = seconds;
+	write_seqcount_end(&tk_seq);
+	local_irq_restore(flags);
+}
+
+void clocksource_register(struct clocksource *cs)
+{
+	uint32_t flags = local_irq_save();
+	write_seqcount_begin(&tk_seq);
+
+	if (!tk.clock || cs->rating > tk.clock->rating)
+	{
+		// fold the old clock up to now, the new one continues from there
+		if (tk.clock)
+			timekeeping_forward(tk.clock->read(tk.clock));
+		tk.clock = cs;
+		tk.cycle_last = cs->read(cs);
+		tk.base_snsec = 0;
+
+		serial_write("CLOCKSOURCE: Using ");
+		serial_write(cs->name);
+		serial_write("\n");
+	}
+
+	write_seqcount_end(&tk_seq);
+	local_irq_restore(flags);
+}
+
+void clocksource_init()
+{
+	serial_write("CLOCKSOURCE: Initializing\n");
+
+	clocksource_register(&clocksource_jiffies);
+
+	serial_write("CLOCKSOURCE: Done\n");
+}
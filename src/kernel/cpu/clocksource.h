@@ -0,0 +1,30 @@
+#ifndef CPU_CLOCKSOURCE_H
+#define CPU_CLOCKSOURCE_H
+
+#include <stdint.h>
+
+#define NSEC_PER_USEC 1000
+#define NSEC_PER_MSEC 1000000
+#define NSEC_PER_SEC 1000000000
+
+// a free running counter, ns = cycles * mult >> shift
+struct clocksource
+{
+	const char *name;
+	uint32_t rating;  // higher is better
+	uint64_t mask;
+	uint32_t mult;
+	uint32_t shift;
+	uint64_t (*read)(struct clocksource *cs);
+};
+
+void clocksource_init();
+void clocksource_register(struct clocksource *cs);
+void clocks_calc_mult_shift(uint32_t *mult, uint32_t *shift, uint32_t from, uint32_t to, uint32_t maxsec);
+void timekeeping_update();
+uint64_t ktime_get_ns();
+uint64_t ktime_get_real_ns();
+void timekeeping_settime(uint32_t seconds);
+void timekeeping_set_boot_seconds(uint32_t seconds);
+
+#endif
@@ -1,5 +1,6 @@
 #include "exceptions.h"
 
+#include <cpu/fpu.h>
 #include <cpu/hal.h>
 #include <cpu/idt.h>
 #include <utils/debug.h>
@@ -50,6 +51,10 @@ static int32_t invalid_opcode_fault(struct interrupt_registers *regs)
 
 static int32_t no_device_fault(struct interrupt_registers *regs)
 {
+	// CR0.TS is set, the running thread touches the fpu for the first time since it was switched in
+	if (fpu_device_not_available(regs))
+		return IRQ_HANDLER_CONTINUE;
+
 	kernel_panic("Device not found");
 	return IRQ_HANDLER_STOP;
 }
@@ -108,6 +113,9 @@ static int32_t page_fault(struct interrupt_registers *regs)
 
 static int32_t fpu_fault(struct interrupt_registers *regs)
 {
+	if (fpu_math_fault(regs))
+		return IRQ_HANDLER_CONTINUE;
+
 	kernel_panic("FPU Fault");
 	return IRQ_HANDLER_STOP;
 }
@@ -126,6 +134,9 @@ static int32_t machine_check_abort(struct interrupt_registers *regs)
 
 static int32_t simd_fpu_fault(struct interrupt_registers *regs)
 {
+	if (fpu_simd_fault(regs))
+		return IRQ_HANDLER_CONTINUE;
+
 	kernel_panic("FPU SIMD fault");
 	return IRQ_HANDLER_STOP;
 }
@@ -0,0 +1,206 @@
+#include "fpu.h"
+
+#include <memory/slab.h>
+#include <utils/debug.h>
+#include <utils/string.h>
+
+#include "hal.h"
+#include "smp.h"
+
+/*
+  Lazy fpu switching
+  The registers are only saved and restored when somebody actually uses them. A context switch
+  just records the incoming thread's state and sets CR0.TS, the first fpu/sse instruction of that
+  thread traps with #NM and the handler swaps the registers with the previous owner's state.
+  Threads that never touch the fpu never pay for fxsave/fxrstor
+*/
+struct fpu_cpu
+{
+	struct fpu_state *owner;	// whose state is loaded in the registers
+	struct fpu_state *current;	// state of the running thread
+	bool in_kernel_fpu;
+	uint32_t kernel_fpu_flags;
+};
+
+static struct kmem_cache *fpu_state_cache;
+static struct fpu_state fpu_clean_state;
+static struct fpu_cpu fpu_cpus[NR_CPUS];
+static bool fpu_has_fxsr;
+
+static __inline void clts()
+{
+	asm volatile("clts");
+}
+
+static __inline void stts()
+{
+	write_cr0(read_cr0() | CR0_TS);
+}
+
+// NOTE: Without fxsr only the x87 state exists and fnsave/frstor are used instead, their
+// 108 byte image fits into the same area. fnsave reinitializes the fpu as a side effect
+static __inline void fpu_save(struct fpu_state *state)
+{
+	if (fpu_has_fxsr)
+		asm volatile("fxsave %0"
+					 : "=m"(*state));
+	else
+		asm volatile("fnsave %0"
+					 : "=m"(*state));
+}
+
+static __inline void fpu_restore(struct fpu_state *state)
+{
+	if (fpu_has_fxsr)
+		asm volatile("fxrstor %0" ::"m"(*state));
+	else
+		asm volatile("frstor %0" ::"m"(*state));
+}
+
+void fpu_init()
+{
+	serial_write("FPU: Initializing\n");
+
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	// fxsave (bit 24) and sse (bit 25)
+	fpu_has_fxsr = edx & (1 << 24);
+	bool has_sse = edx & (1 << 25);
+
+	// native x87 error reporting, wait/fwait honours TS
+	write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+	if (fpu_has_fxsr)
+		write_cr4(read_cr4() | CR4_OSFXSR | (has_sse ? CR4_OSXMMEXCPT : 0));
+
+	// the state every thread starts with
+	asm volatile("fninit");
+	fpu_save(&fpu_clean_state);
+
+	fpu_state_cache = kmem_cache_create("fpu_state", sizeof(struct fpu_state), 16, NULL);
+
+	// nobody owns the registers yet, the first user traps
+	stts();
+
+	serial_write("FPU: Done\n");
+}
+
+struct fpu_state *fpu_alloc_state()
+{
+	struct fpu_state *state = kmem_cache_alloc(fpu_state_cache);
+	if (state)
+		memcpy(state, &fpu_clean_state, sizeof(struct fpu_state));
+	return state;
+}
+
+void fpu_free_state(struct fpu_state *state)
+{
+	struct fpu_cpu *cpu = &fpu_cpus[smp_processor_id()];
+
+	uint32_t flags = local_irq_save();
+	if (cpu->owner == state)
+		cpu->owner = NULL;
+	if (cpu->current == state)
+		cpu->current = NULL;
+	local_irq_restore(flags);
+
+	kmem_cache_free(fpu_state_cache, state);
+}
+
+// NOTE: Called by the scheduler on every switch, next is the incoming thread's fpu state
+void fpu_switch_to(struct fpu_state *next)
+{
+	struct fpu_cpu *cpu = &fpu_cpus[smp_processor_id()];
+
+	cpu->current = next;
+	// switching back to the owner before anybody else used the fpu needs no trap at all
+	if (next && next == cpu->owner)
+		clts();
+	else
+		stts();
+}
+
+// #NM, returns false if the fault can't be resolved (a thread without fpu state)
+bool fpu_device_not_available(struct interrupt_registers *regs)
+{
+	struct fpu_cpu *cpu = &fpu_cpus[smp_processor_id()];
+
+	if (!cpu->current)
+		return false;
+
+	clts();
+	if (cpu->owner != cpu->current)
+	{
+		if (cpu->owner)
+			fpu_save(cpu->owner);
+		fpu_restore(cpu->current);
+		cpu->owner = cpu->current;
+	}
+	return true;
+}
+
+// NOTE: There are no signals yet, so an unmasked exception raised by a thread is masked in that
+// thread's control word and the thread goes on with the IEEE default result. The registers belong
+// to the faulting thread, it just executed a fpu/sse instruction. Kernel sections run with every
+// exception masked, one showing up there is a bug and returns false
+bool fpu_math_fault(struct interrupt_registers *regs)
+{
+	if (!(regs->cs & 3))
+		return false;
+
+	uint16_t status, control;
+	asm volatile("fnstsw %0"
+				 : "=m"(status));
+	asm volatile("fnstcw %0"
+				 : "=m"(control));
+	control |= status & FPU_EXCEPTIONS;
+	asm volatile("fnclex");
+	asm volatile("fldcw %0" ::"m"(control));
+
+	serial_write("FPU: Masked x87 exception\n");
+	return true;
+}
+
+bool fpu_simd_fault(struct interrupt_registers *regs)
+{
+	if (!(regs->cs & 3))
+		return false;
+
+	uint32_t mxcsr;
+	asm volatile("stmxcsr %0"
+				 : "=m"(mxcsr));
+	mxcsr |= (mxcsr & FPU_EXCEPTIONS) << MXCSR_MASK_SHIFT;
+	mxcsr &= ~FPU_EXCEPTIONS;
+	asm volatile("ldmxcsr %0" ::"m"(mxcsr));
+
+	serial_write("FPU: Masked SIMD exception\n");
+	return true;
+}
+
+// NOTE: Kernel simd sections run with interrupts disabled, so they can't be preempted or nested.
+// Keep them short, the owner's registers are saved first and reloaded lazily afterwards
+void kernel_fpu_begin()
+{
+	struct fpu_cpu *cpu = &fpu_cpus[smp_processor_id()];
+	uint32_t flags = local_irq_save();
+
+	assert(!cpu->in_kernel_fpu);
+	cpu->in_kernel_fpu = true;
+	cpu->kernel_fpu_flags = flags;
+
+	clts();
+	if (cpu->owner)
+	{
+		fpu_save(cpu->owner);
+		cpu->owner = NULL;
+	}
+	fpu_restore(&fpu_clean_state);
+}
+
+void kernel_fpu_end()
+{
+	struct fpu_cpu *cpu = &fpu_cpus[smp_processor_id()];
+
+	stts();
+	cpu->in_kernel_fpu = false;
+	local_irq_restore(cpu->kernel_fpu_flags);
+}
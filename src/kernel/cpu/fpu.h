@@ -0,0 +1,38 @@
+#ifndef CPU_FPU_H
+#define CPU_FPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "idt.h"
+
+#define CR0_MP 0x2
+#define CR0_EM 0x4
+#define CR0_TS 0x8
+#define CR0_NE 0x20
+#define CR4_OSFXSR 0x200
+#define CR4_OSXMMEXCPT 0x400
+
+#define FXSAVE_SIZE 512
+// invalid, denormal, divide by zero, overflow, underflow and precision: status/mxcsr flag bits 0-5,
+// mask bits 0-5 of the x87 control word and 7-12 of mxcsr
+#define FPU_EXCEPTIONS 0x3f
+#define MXCSR_MASK_SHIFT 7
+
+// fxsave/fxrstor area (or fnsave/frstor without fxsr), the processor requires 16 byte alignment
+struct fpu_state
+{
+	uint8_t fxsave[FXSAVE_SIZE];
+} __attribute__((aligned(16)));
+
+void fpu_init();
+struct fpu_state *fpu_alloc_state();
+void fpu_free_state(struct fpu_state *state);
+void fpu_switch_to(struct fpu_state *next);
+bool fpu_device_not_available(struct interrupt_registers *regs);
+bool fpu_math_fault(struct interrupt_registers *regs);
+bool fpu_simd_fault(struct interrupt_registers *regs);
+void kernel_fpu_begin();
+void kernel_fpu_end();
+
+#endif
@@ -32,4 +32,84 @@ static __inline void halt()
 static __inline void disable_interrupts()
 {
 	asm volatile("cli");
-}
\ No newline at end of file
+}
+static __inline void enable_interrupts()
+{
+	asm volatile("sti");
+}
+
+static __inline uint32_t local_irq_save()
+{
+	uint32_t flags;
+	asm volatile("pushf\n"
+				 "pop %0\n"
+				 "cli"
+				 : "=r"(flags)
+				 :
+				 : "memory");
+	return flags;
+}
+
+static __inline void local_irq_restore(uint32_t flags)
+{
+	if (flags & 0x200)
+		asm volatile("sti" ::: "memory");
+}
+
+static __inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+	asm volatile("cpuid"
+				 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+				 : "a"(leaf), "c"(0));
+}
+
+static __inline uint64_t rdmsr(uint32_t msr)
+{
+	uint32_t lo, hi;
+	asm volatile("rdmsr"
+				 : "=a"(lo), "=d"(hi)
+				 : "c"(msr));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static __inline void wrmsr(uint32_t msr, uint64_t value)
+{
+	asm volatile("wrmsr" ::"c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32))
+				 : "memory");
+}
+
+static __inline uint64_t rdtsc()
+{
+	uint32_t lo, hi;
+	asm volatile("rdtsc"
+				 : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static __inline uint32_t read_cr0()
+{
+	uint32_t value;
+	asm volatile("mov %%cr0, %0"
+				 : "=r"(value));
+	return value;
+}
+
+static __inline void write_cr0(uint32_t value)
+{
+	asm volatile("mov %0, %%cr0" ::"r"(value)
+				 : "memory");
+}
+
+static __inline uint32_t read_cr4()
+{
+	uint32_t value;
+	asm volatile("mov %%cr4, %0"
+				 : "=r"(value));
+	return value;
+}
+
+static __inline void write_cr4(uint32_t value)
+{
+	asm volatile("mov %0, %%cr4" ::"r"(value)
+				 : "memory");
+}
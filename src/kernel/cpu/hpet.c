@@ -0,0 +1,212 @@
+#include "hpet.h"
+
+#include <devices/char/tty.h>
+#include <memory/vmm.h>
+#include <system/acpi.h>
+#include <utils/debug.h>
+#include <utils/math.h>
+
+#include "apic.h"
+#include "clockevents.h"
+#include "clocksource.h"
+#include "hal.h"
+#include "tick.h"
+
+// jiffies only advance from the event handler, so an idle one-shot is kept within the pit's range
+#define HPET_MAX_DELTA_US 54925
+#define HPET_MIN_DELTA_US 20
+
+static volatile uint32_t *hpet_base;
+static uint32_t hpet_khz;
+static bool hpet_64bit;
+static uint32_t hpet_delta;	 // ticks of the current period or one-shot
+
+static uint32_t hpet_readl(uint32_t reg)
+{
+	return hpet_base[reg / 4];
+}
+
+static void hpet_writel(uint32_t reg, uint32_t value)
+{
+	hpet_base[reg / 4] = value;
+}
+
+// NOTE: Two 32 bit reads, the high half is read again in case the low half wrapped in between
+static uint64_t hpet_read_counter()
+{
+	if (!hpet_64bit)
+		return hpet_readl(HPET_COUNTER);
+
+	uint32_t high, low;
+	do
+	{
+		high = hpet_readl(HPET_COUNTER + 4);
+		low = hpet_readl(HPET_COUNTER);
+	} while (high != hpet_readl(HPET_COUNTER + 4));
+
+	return ((uint64_t)high << 32) | low;
+}
+
+static uint64_t hpet_clocksource_read(struct clocksource *cs)
+{
+	return hpet_read_counter();
+}
+
+static struct clocksource clocksource_hpet = {
+	.name = "hpet",
+	.rating = 250,
+	.read = hpet_clocksource_read,
+};
+
+static uint32_t hpet_us_to_ticks(uint32_t us)
+{
+	return div_u64((uint64_t)us * hpet_khz, 1000);
+}
+
+static uint32_t hpet_ticks_to_us(uint32_t ticks)
+{
+	return div_u64((uint64_t)ticks * 1000, hpet_khz);
+}
+
+// NOTE: Comparators are only used in 32 bit mode, a delta never gets near 2^31 ticks
+static void hpet_set_periodic(struct clock_event_device *dev)
+{
+	uint32_t cfg = hpet_readl(HPET_Tn_CFG(0)) & ~HPET_TN_LEVEL;
+
+	hpet_delta = hpet_us_to_ticks(TICK_USEC);
+	// with SETVAL the first write sets the comparator, the second one the period
+	hpet_writel(HPET_Tn_CFG(0), cfg | HPET_TN_ENABLE | HPET_TN_PERIODIC | HPET_TN_SETVAL | HPET_TN_32BIT);
+	hpet_writel(HPET_Tn_CMP(0), (uint32_t)hpet_read_counter() + hpet_delta);
+	hpet_writel(HPET_Tn_CMP(0), hpet_delta);
+}
+
+static void hpet_set_oneshot(struct clock_event_device *dev)
+{
+	uint32_t cfg = hpet_readl(HPET_Tn_CFG(0)) & ~(HPET_TN_PERIODIC | HPET_TN_LEVEL);
+	hpet_writel(HPET_Tn_CFG(0), cfg | HPET_TN_ENABLE | HPET_TN_32BIT);
+}
+
+static void hpet_shutdown(struct clock_event_device *dev)
+{
+	uint32_t cfg = hpet_readl(HPET_Tn_CFG(0));
+	hpet_writel(HPET_Tn_CFG(0), cfg & ~(HPET_TN_ENABLE | HPET_TN_PERIODIC));
+}
+
+// comparators only match on equality, a deadline which has already passed would never fire
+static int32_t hpet_set_next_event(uint32_t delta_us, struct clock_event_device *dev)
+{
+	hpet_delta = hpet_us_to_ticks(delta_us);
+
+	uint32_t cmp = (uint32_t)hpet_read_counter() + hpet_delta;
+	hpet_writel(HPET_Tn_CMP(0), cmp);
+
+	return (int32_t)(cmp - (uint32_t)hpet_read_counter()) > 0 ? 0 : -1;
+}
+
+// the comparator holds the next expiry, in periodic mode as well
+static uint32_t hpet_get_elapsed_us(struct clock_event_device *dev)
+{
+	uint32_t start = hpet_readl(HPET_Tn_CMP(0)) - hpet_delta;
+	uint32_t elapsed = (uint32_t)hpet_read_counter() - start;
+
+	return hpet_ticks_to_us(elapsed < hpet_delta ? elapsed : hpet_delta);
+}
+
+static struct clock_event_device hpet_clockevent = {
+	.name = "hpet",
+	.features = CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT,
+	.rating = 150,
+	.min_delta_us = HPET_MIN_DELTA_US,
+	.max_delta_us = HPET_MAX_DELTA_US,
+	.set_next_event = hpet_set_next_event,
+	.set_state_periodic = hpet_set_periodic,
+	.set_state_oneshot = hpet_set_oneshot,
+	.set_state_shutdown = hpet_shutdown,
+	.get_elapsed_us = hpet_get_elapsed_us,
+};
+
+// NOTE: irq16 has its own stub in interrupt.asm which calls this directly
+int32_t hpet_interrupt(struct interrupt_registers *regs)
+{
+	irq_ack(regs->int_no);
+
+	if (hpet_clockevent.event_handler)
+		hpet_clockevent.event_handler(&hpet_clockevent);
+
+	return IRQ_HANDLER_CONTINUE;
+}
+
+// NOTE: Timer 0 is routed through the ioapic, legacy replacement mode would take irq8 away from
+// the rtc. Without an ioapic or a periodic capable timer 0, the hpet is only a clocksource
+static bool hpet_setup_clockevent()
+{
+	uint32_t cfg = hpet_readl(HPET_Tn_CFG(0));
+	uint32_t route_cap = hpet_readl(HPET_Tn_ROUTE(0));
+
+	if (!apic_enabled() || !(cfg & HPET_TN_PERIODIC_CAP))
+		return false;
+
+	// the highest possible gsi is the least likely to be shared with a pci device
+	for (int32_t gsi = 31; gsi >= 0; --gsi)
+	{
+		if (!(route_cap & (1u << gsi)) || !ioapic_route_gsi(gsi, IRQ16, 0))
+			continue;
+
+		cfg &= ~(HPET_TN_ENABLE | HPET_TN_LEVEL | (0x1f << HPET_TN_ROUTE_SHIFT));
+		hpet_writel(HPET_Tn_CFG(0), cfg | (gsi << HPET_TN_ROUTE_SHIFT));
+		clockevents_register_device(&hpet_clockevent);
+		return true;
+	}
+
+	return false;
+}
+
+bool hpet_init()
+{
+	serial_write("HPET: Initializing\n");
+
+	struct acpi_hpet *table = (struct acpi_hpet *)acpi_find_table("HPET");
+	if (!table || table->address.address_space != 0 || (table->address.address >> 32))
+	{
+		serial_write("HPET: Not available\n");
+		return false;
+	}
+
+	hpet_base = ioremap(table->address.address, PMM_FRAME_SIZE);
+	if (!hpet_base)
+	{
+		serial_write("HPET: Failed to map registers\n");
+		return false;
+	}
+
+	uint32_t period = hpet_readl(HPET_PERIOD);
+	if (!period || period > HPET_MAX_PERIOD)
+	{
+		serial_write("HPET: Invalid period\n");
+		iounmap((void *)hpet_base, PMM_FRAME_SIZE);
+		hpet_base = NULL;
+		return false;
+	}
+	hpet_khz = div_u64(1000000000000ULL, period);
+	hpet_64bit = hpet_readl(HPET_ID) & HPET_ID_64BIT;
+
+	// start counting from zero, in normal (non legacy) routing
+	uint32_t cfg = hpet_readl(HPET_CFG) & ~(HPET_CFG_ENABLE | HPET_CFG_LEGACY);
+	hpet_writel(HPET_CFG, cfg);
+	hpet_writel(HPET_COUNTER, 0);
+	hpet_writel(HPET_COUNTER + 4, 0);
+	hpet_writel(HPET_CFG, cfg | HPET_CFG_ENABLE);
+
+	clocksource_hpet.mask = hpet_64bit ? 0xffffffffffffffffULL : 0xffffffff;
+	clocks_calc_mult_shift(&clocksource_hpet.mult, &clocksource_hpet.shift, hpet_khz, NSEC_PER_MSEC, 600);
+	clocksource_register(&clocksource_hpet);
+
+	if (!hpet_setup_clockevent())
+		serial_write("HPET: No clock events, keeping the pit\n");
+
+	serial_write("HPET: ");
+	serial_write_number(hpet_khz, 10);
+	serial_write(" kHz\n");
+	serial_write("HPET: Done\n");
+	return true;
+}
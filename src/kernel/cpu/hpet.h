@@ -0,0 +1,37 @@
+#ifndef CPU_HPET_H
+#define CPU_HPET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "idt.h"
+
+#define HPET_ID 0x000
+#define HPET_PERIOD 0x004
+#define HPET_CFG 0x010
+#define HPET_STATUS 0x020
+#define HPET_COUNTER 0x0F0
+#define HPET_Tn_CFG(n) (0x100 + 0x20 * (n))
+#define HPET_Tn_ROUTE(n) (0x104 + 0x20 * (n))
+#define HPET_Tn_CMP(n) (0x108 + 0x20 * (n))
+
+#define HPET_ID_64BIT 0x2000
+#define HPET_CFG_ENABLE 0x1
+#define HPET_CFG_LEGACY 0x2
+
+#define HPET_TN_LEVEL 0x2
+#define HPET_TN_ENABLE 0x4
+#define HPET_TN_PERIODIC 0x8
+#define HPET_TN_PERIODIC_CAP 0x10
+#define HPET_TN_64BIT_CAP 0x20
+#define HPET_TN_SETVAL 0x40
+#define HPET_TN_32BIT 0x100
+#define HPET_TN_ROUTE_SHIFT 9
+
+// femtoseconds per tick can't be larger than 100ns by spec
+#define HPET_MAX_PERIOD 100000000
+
+bool hpet_init();
+int32_t hpet_interrupt(struct interrupt_registers *regs);
+
+#endif
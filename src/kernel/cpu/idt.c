@@ -3,6 +3,8 @@
 #include <utils/debug.h>
 #include <utils/string.h>
 
+#include "apic.h"
+#include "irq_stats.h"
 #include "pic.h"
 
 extern void idt_flush(uint32_t);
@@ -117,6 +119,7 @@ void idt_init()
 	setvect(45, (I86_IVT)irq13);
 	setvect(46, (I86_IVT)irq14);
 	setvect(47, (I86_IVT)irq15);
+	setvect(48, (I86_IVT)irq16);
 
 	setvect_flags(DISPATCHER_ISR, (I86_IVT)isr127, I86_IDT_DESC_RING3);
 
@@ -138,7 +141,10 @@ static void handle_interrupt(struct interrupt_registers *regs)
     if (interrupt_handlers[int_no] != NULL)
     {
         interrupt_handler (*handler)() = interrupt_handlers[int_no];
+        uint64_t entry = irq_entry_tsc;
+        uint64_t start = rdtsc();
         handler(regs);
+        irq_stats_record(int_no, (uint32_t)handler, regs->eip, entry, start, rdtsc());
     }
     else
     {
@@ -154,11 +160,33 @@ void isr_handler(struct interrupt_registers *reg)
 
 void irq_ack(uint32_t irq_number)
 {
+	if (apic_enabled())
+	{
+		apic_eoi();
+		return;
+	}
+
 	if (irq_number >= 40)
 		outportb(PIC2_COMMAND, PIC_EOI);
 	outportb(PIC1_COMMAND, PIC_EOI);
 }
 
+void irq_set_mask(uint8_t irq_line)
+{
+	if (apic_enabled())
+		ioapic_set_mask(irq_line);
+	else
+		pic_set_mask(irq_line);
+}
+
+void irq_clear_mask(uint8_t irq_line)
+{
+	if (apic_enabled())
+		ioapic_clear_mask(irq_line);
+	else
+		pic_clear_mask(irq_line);
+}
+
 void irq_handler(struct interrupt_registers *reg)
 {
 	handle_interrupt(reg);
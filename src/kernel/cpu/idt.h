@@ -104,6 +104,7 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+extern void irq16();
 
 #define IRQ0 32
 #define IRQ1 33
@@ -121,8 +122,12 @@ extern void irq15();
 #define IRQ13 45
 #define IRQ14 46
 #define IRQ15 47
+// not an ISA irq, only reachable through the ioapic
+#define IRQ16 48
 
 void irq_ack(uint32_t irq_number);
+void irq_set_mask(uint8_t irq_line);
+void irq_clear_mask(uint8_t irq_line);
 void isr_handler(struct interrupt_registers *);
 void irq_handler(struct interrupt_registers *);
 
@@ -1,392 +1,199 @@
 [extern isr_handler]
 [extern irq_handler]
-
-; Common ISR code
-isr_common_stub:
-    ; 1. Save CPU state
+[extern irq_enter]
+[extern irq_exit]
+[extern irq_entry_tsc]
+[extern irq_counts]
+[extern timer_interrupt]
+[extern hpet_interrupt]
+
+; Offset of the interrupted cs inside struct interrupt_registers
+; (gs, fs, es, ds = 16, pusha = 32, int_no + err_code = 8, eip = 4)
+%define REGS_CS 60
+
+; Save the CPU state in the layout of struct interrupt_registers.
+; The segment registers are always pushed, but they only have to be
+; reloaded when we come from user mode: a kernel context already runs
+; on the kernel selectors.
+%macro SAVE_CONTEXT 0
     pusha ; Pushes edi,esi,ebp,esp,ebx,edx,ecx,eax
 
     push ds
     push es
     push fs
     push gs
+
+    test byte [esp + REGS_CS], 3
+    jz %%kernel
     mov ax, 0x10  ; kernel data segment descriptor
     mov ds, ax
     mov es, ax
     mov fs, ax
     mov gs, ax
-    ; 2. Call C handler
+%%kernel:
     cld ; C code following the sysV ABI requires DF to be clear on function entry
-    push esp ; interrupt_registers *r
-    call isr_handler
-    add esp, 4
-    
-    ; 3. Restore state
+%endmacro
+
+; Restore the CPU state and return. cs is checked again because a handler
+; may have switched the frame to another context. Returning to the kernel
+; takes the fast path: the segments never changed, so they are dropped
+; instead of being popped (every segment load is a descriptor fetch).
+%macro RESTORE_CONTEXT 0
+    test byte [esp + REGS_CS], 3
+    jnz %%user
+    add esp, 16
+    popa
+    add esp, 8 ; Cleans up the pushed error code and pushed ISR number
+    iret
+%%user:
     pop gs
     pop fs
     pop es
     pop ds
-    
+
     popa
-    add esp, 8 ; Cleans up the pushed error code and pushed ISR number
+    add esp, 8
     iret ; pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
+%endmacro
 
-; Common IRQ code. Identical to ISR code except for the 'call' 
-; and the 'pop ebx'
-irq_common_stub:
-    pusha 
+; Entry timestamp for the irq latency histograms, eax and edx are already saved
+%macro STAMP_ENTRY 0
+    rdtsc
+    mov [irq_entry_tsc], eax
+    mov [irq_entry_tsc + 4], edx
+%endmacro
 
-    push ds
-    push es
-    push fs
-    push gs
-    mov ax, 0x10
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+; Common ISR code
+isr_common_stub:
+    SAVE_CONTEXT
+    STAMP_ENTRY
+
+    push esp ; interrupt_registers *r
+    call isr_handler
+    add esp, 4
+
+    RESTORE_CONTEXT
+
+; Common IRQ code. Identical to ISR code except that handlers run
+; between irq_enter and irq_exit
+irq_common_stub:
+    SAVE_CONTEXT
+    STAMP_ENTRY
 
-    cld
+    call irq_enter
     push esp
-    call irq_handler ; Different than the ISR code
+    call irq_handler
     add esp, 4
+    call irq_exit ; runs pending softirqs with interrupts enabled, the handler already sent EOI
 
-    pop gs
-    pop fs
-    pop es
-    pop ds
+    RESTORE_CONTEXT
 
-    popa
-    add esp, 8
-    iret 
-    
 ; We don't get information about which interrupt was caller
 ; when the handler is run, so we will need to have a different handler
 ; for every interrupt.
 ; Furthermore, some interrupts push an error code onto the stack but others
 ; don't, so we will push a dummy error code for those which don't, so that
 ; we have a consistent stack for all of them.
-
-; First make the ISRs global
-[global isr0]
-[global isr1]
-[global isr2]
-[global isr3]
-[global isr4]
-[global isr5]
-[global isr6]
-[global isr7]
-[global isr8]
-[global isr9]
-[global isr10]
-[global isr11]
-[global isr12]
-[global isr13]
-[global isr14]
-[global isr15]
-[global isr16]
-[global isr17]
-[global isr18]
-[global isr19]
-[global isr20]
-[global isr21]
-[global isr22]
-[global isr23]
-[global isr24]
-[global isr25]
-[global isr26]
-[global isr27]
-[global isr28]
-[global isr29]
-[global isr30]
-[global isr31]
-[global isr127]
-; IRQs
-[global irq0]
-[global irq1]
-[global irq2]
-[global irq3]
-[global irq4]
-[global irq5]
-[global irq6]
-[global irq7]
-[global irq8]
-[global irq9]
-[global irq10]
-[global irq11]
-[global irq12]
-[global irq13]
-[global irq14]
-[global irq15]
-
-; 0: Divide By Zero Exception
-isr0:
-    push byte 0
-    push byte 0
-    jmp isr_common_stub
-
-; 1: Debug Exception
-isr1:
-    push byte 0
-    push byte 1
-    jmp isr_common_stub
-
-; 2: Non Maskable Interrupt Exception
-isr2:
-    push byte 0
-    push byte 2
-    jmp isr_common_stub
-
-; 3: Int 3 Exception
-isr3:
-    push byte 0
-    push byte 3
-    jmp isr_common_stub
-
-; 4: INTO Exception
-isr4:
-    push byte 0
-    push byte 4
-    jmp isr_common_stub
-
-; 5: Out of Bounds Exception
-isr5:
-    push byte 0
-    push byte 5
-    jmp isr_common_stub
-
-; 6: Invalid Opcode Exception
-isr6:
-    push byte 0
-    push byte 6
-    jmp isr_common_stub
-
-; 7: Coprocessor Not Available Exception
-isr7:
-    push byte 0
-    push byte 7
-    jmp isr_common_stub
-
-; 8: Double Fault Exception (With Error Code!)
-isr8:
-    push byte 8
-    jmp isr_common_stub
-
-; 9: Coprocessor Segment Overrun Exception
-isr9:
-    push byte 0
-    push byte 9
-    jmp isr_common_stub
-
-; 10: Bad TSS Exception (With Error Code!)
-isr10:
-    push byte 10
-    jmp isr_common_stub
-
-; 11: Segment Not Present Exception (With Error Code!)
-isr11:
-    push byte 11
-    jmp isr_common_stub
-
-; 12: Stack Fault Exception (With Error Code!)
-isr12:
-    push byte 12
-    jmp isr_common_stub
-
-; 13: General Protection Fault Exception (With Error Code!)
-isr13:
-    push byte 13
-    jmp isr_common_stub
-
-; 14: Page Fault Exception (With Error Code!)
-isr14:
-    push byte 14
-    jmp isr_common_stub
-
-; 15: Reserved Exception
-isr15:
-    push byte 0
-    push byte 15
-    jmp isr_common_stub
-
-; 16: Floating Point Exception
-isr16:
-    push byte 0
-    push byte 16
-    jmp isr_common_stub
-
-; 17: Alignment Check Exception
-isr17:
-    push byte 0
-    push byte 17
-    jmp isr_common_stub
-
-; 18: Machine Check Exception
-isr18:
-    push byte 0
-    push byte 18
-    jmp isr_common_stub
-
-; 19: Reserved
-isr19:
-    push byte 0
-    push byte 19
-    jmp isr_common_stub
-
-; 20: Reserved
-isr20:
-    push byte 0
-    push byte 20
-    jmp isr_common_stub
-
-; 21: Reserved
-isr21:
-    push byte 0
-    push byte 21
-    jmp isr_common_stub
-
-; 22: Reserved
-isr22:
-    push byte 0
-    push byte 22
-    jmp isr_common_stub
-
-; 23: Reserved
-isr23:
-    push byte 0
-    push byte 23
-    jmp isr_common_stub
-
-; 24: Reserved
-isr24:
-    push byte 0
-    push byte 24
-    jmp isr_common_stub
-
-; 25: Reserved
-isr25:
-    push byte 0
-    push byte 25
-    jmp isr_common_stub
-
-; 26: Reserved
-isr26:
-    push byte 0
-    push byte 26
-    jmp isr_common_stub
-
-; 27: Reserved
-isr27:
-    push byte 0
-    push byte 27
-    jmp isr_common_stub
-
-; 28: Reserved
-isr28:
-    push byte 0
-    push byte 28
-    jmp isr_common_stub
-
-; 29: Reserved
-isr29:
+%macro ISR_NOERRCODE 1
+[global isr%1]
+isr%1:
     push byte 0
-    push byte 29
+    push %1
     jmp isr_common_stub
+%endmacro
 
-; 30: Reserved
-isr30:
-    push byte 0
-    push byte 30
-    jmp isr_common_stub
-
-; 31: Reserved
-isr31:
-    push byte 0
-    push byte 31
-    jmp isr_common_stub
-
-isr127:
-    push byte 0
-    push 0x7F
+%macro ISR_ERRCODE 1
+[global isr%1]
+isr%1:
+    push %1
     jmp isr_common_stub
+%endmacro
 
-; IRQ handlers
-irq0:
-    push byte 0
-    push byte 32
-    jmp irq_common_stub
-
-irq1:
-    push byte 1
-    push byte 33
-    jmp irq_common_stub
-
-irq2:
-    push byte 2
-    push byte 34
-    jmp irq_common_stub
-
-irq3:
-    push byte 3
-    push byte 35
-    jmp irq_common_stub
-
-irq4:
-    push byte 4
-    push byte 36
-    jmp irq_common_stub
-
-irq5:
-    push byte 5
-    push byte 37
-    jmp irq_common_stub
-
-irq6:
-    push byte 6
-    push byte 38
-    jmp irq_common_stub
-
-irq7:
-    push byte 7
-    push byte 39
-    jmp irq_common_stub
-
-irq8:
-    push byte 8
-    push byte 40
-    jmp irq_common_stub
-
-irq9:
-    push byte 9
-    push byte 41
-    jmp irq_common_stub
-
-irq10:
-    push byte 10
-    push byte 42
-    jmp irq_common_stub
-
-irq11:
-    push byte 11
-    push byte 43
-    jmp irq_common_stub
-
-irq12:
-    push byte 12
-    push byte 44
-    jmp irq_common_stub
-
-irq13:
-    push byte 13
-    push byte 45
-    jmp irq_common_stub
-
-irq14:
-    push byte 14
-    push byte 46
+; irq number, vector
+%macro IRQ 2
+[global irq%1]
+irq%1:
+    push byte %1
+    push byte %2
     jmp irq_common_stub
+%endmacro
+
+; irq number, vector, handler
+; Hot vectors get their own stub which calls the C handler directly, without
+; the trip through irq_handler and the handler table. They only bump their
+; counter in the irq statistics, latency and duration are not measured
+%macro IRQ_DIRECT 3
+[global irq%1]
+irq%1:
+    push byte %1
+    push byte %2
+    SAVE_CONTEXT
+    inc dword [irq_counts + %2 * 4]
+
+    call irq_enter
+    push esp
+    call %3
+    add esp, 4
+    call irq_exit
+
+    RESTORE_CONTEXT
+%endmacro
+
+ISR_NOERRCODE 0  ; Divide By Zero Exception
+ISR_NOERRCODE 1  ; Debug Exception
+ISR_NOERRCODE 2  ; Non Maskable Interrupt Exception
+ISR_NOERRCODE 3  ; Int 3 Exception
+ISR_NOERRCODE 4  ; INTO Exception
+ISR_NOERRCODE 5  ; Out of Bounds Exception
+ISR_NOERRCODE 6  ; Invalid Opcode Exception
+ISR_NOERRCODE 7  ; Coprocessor Not Available Exception
+ISR_ERRCODE 8    ; Double Fault Exception
+ISR_NOERRCODE 9  ; Coprocessor Segment Overrun Exception
+ISR_ERRCODE 10   ; Bad TSS Exception
+ISR_ERRCODE 11   ; Segment Not Present Exception
+ISR_ERRCODE 12   ; Stack Fault Exception
+ISR_ERRCODE 13   ; General Protection Fault Exception
+ISR_ERRCODE 14   ; Page Fault Exception
+ISR_NOERRCODE 15 ; Reserved
+ISR_NOERRCODE 16 ; Floating Point Exception
+ISR_ERRCODE 17   ; Alignment Check Exception
+ISR_NOERRCODE 18 ; Machine Check Exception
+ISR_NOERRCODE 19 ; SIMD Floating Point Exception
+ISR_NOERRCODE 20 ; Virtualization Exception
+ISR_ERRCODE 21   ; Control Protection Exception
+ISR_NOERRCODE 22 ; Reserved
+ISR_NOERRCODE 23 ; Reserved
+ISR_NOERRCODE 24 ; Reserved
+ISR_NOERRCODE 25 ; Reserved
+ISR_NOERRCODE 26 ; Reserved
+ISR_NOERRCODE 27 ; Reserved
+ISR_NOERRCODE 28 ; Reserved
+ISR_NOERRCODE 29 ; Reserved
+ISR_ERRCODE 30   ; Security Exception
+ISR_NOERRCODE 31 ; Reserved
+ISR_NOERRCODE 127 ; Syscall dispatcher
 
-irq15:
-    push byte 15
-    push byte 47
-    jmp irq_common_stub
\ No newline at end of file
+; IRQ handlers
+IRQ_DIRECT 0, 32, timer_interrupt
+IRQ 1, 33
+IRQ 2, 34
+IRQ 3, 35
+IRQ 4, 36
+IRQ 5, 37
+IRQ 6, 38
+IRQ 7, 39
+IRQ 8, 40
+IRQ 9, 41
+IRQ 10, 42
+IRQ 11, 43
+IRQ 12, 44
+IRQ 13, 45
+IRQ 14, 46
+IRQ 15, 47
+IRQ_DIRECT 16, 48, hpet_interrupt
+
+[global apic_spurious_irq]
+
+; Spurious interrupts from the local apic must not be acknowledged
+apic_spurious_irq:
+    iret
@@ -0,0 +1,148 @@
+#include "irq_stats.h"
+
+#include <devices/char/tty.h>
+#include <utils/string.h>
+
+#include "hal.h"
+#include "idt.h"
+
+extern volatile uint32_t jiffies;
+
+// written by the interrupt stubs right after saving registers
+volatile uint64_t irq_entry_tsc;
+volatile uint32_t irq_counts[I86_MAX_INTERRUPTS];
+
+static struct irq_stat irq_stats[I86_MAX_INTERRUPTS];
+static struct irq_offender offenders[IRQ_STATS_OFFENDERS];
+
+static uint32_t irq_stats_bucket(uint64_t cycles)
+{
+	if (cycles >> 32)
+		return IRQ_STATS_BUCKETS - 1;
+
+	uint32_t bucket = cycles ? 31 - __builtin_clz((uint32_t)cycles) : 0;
+	return bucket < IRQ_STATS_BUCKETS ? bucket : IRQ_STATS_BUCKETS - 1;
+}
+
+// keep the slowest handlers seen so far, the fastest entry is evicted first
+static void irq_stats_log_offender(uint8_t vector, uint32_t handler, uint32_t eip, uint64_t duration)
+{
+	struct irq_offender *slot = &offenders[0];
+	for (uint32_t i = 1; i < IRQ_STATS_OFFENDERS; ++i)
+		if (offenders[i].duration < slot->duration)
+			slot = &offenders[i];
+
+	if (slot->duration >= duration)
+		return;
+
+	slot->vector = vector;
+	slot->handler = handler;
+	slot->eip = eip;
+	slot->jiffies = jiffies;
+	slot->duration = duration;
+}
+
+// NOTE: Called with interrupts disabled from handle_interrupt, nothing here may block or print
+void irq_stats_record(uint8_t vector, uint32_t handler, uint32_t eip, uint64_t entry, uint64_t start, uint64_t end)
+{
+	struct irq_stat *stat = &irq_stats[vector];
+	uint64_t duration = end - start;
+
+	irq_counts[vector]++;
+	stat->latency[irq_stats_bucket(start - entry)]++;
+	stat->duration[irq_stats_bucket(duration)]++;
+	if (duration > stat->max_duration)
+		stat->max_duration = duration;
+
+	if (duration >= IRQ_STATS_SLOW_CYCLES)
+		irq_stats_log_offender(vector, handler, eip, duration);
+}
+
+void irq_stats_reset()
+{
+	uint32_t flags = local_irq_save();
+	memset(irq_stats, 0, sizeof(irq_stats));
+	memset((void *)irq_counts, 0, sizeof(irq_counts));
+	memset(offenders, 0, sizeof(offenders));
+	local_irq_restore(flags);
+}
+
+static void irq_stats_dump_histogram(const char *name, uint32_t *buckets)
+{
+	serial_write(name);
+	for (uint32_t i = 0; i < IRQ_STATS_BUCKETS; ++i)
+	{
+		if (!buckets[i])
+			continue;
+		serial_write(" 2^");
+		serial_write_number(i, 10);
+		serial_write(":");
+		serial_write_number(buckets[i], 10);
+	}
+	serial_write("\n");
+}
+
+// cycles above 2^32 are clamped, that is seconds on any machine we run on
+static uint32_t irq_stats_clamp(uint64_t cycles)
+{
+	return cycles >> 32 ? 0xffffffff : (uint32_t)cycles;
+}
+
+void irq_stats_dump()
+{
+	serial_write("IRQ stats (cycles, log2 buckets)\n");
+	for (uint32_t vector = 0; vector < I86_MAX_INTERRUPTS; ++vector)
+	{
+		// snapshot, a dump must not hold interrupts off while printing
+		struct irq_stat stat;
+		uint32_t flags = local_irq_save();
+		stat = irq_stats[vector];
+		uint32_t count = irq_counts[vector];
+		local_irq_restore(flags);
+
+		if (!count)
+			continue;
+
+		serial_write("vector ");
+		serial_write_number(vector, 16);
+		serial_write(" count ");
+		serial_write_number(count, 10);
+		// direct stubs only count, they never go through irq_stats_record
+		if (!stat.max_duration)
+		{
+			serial_write("\n");
+			continue;
+		}
+		serial_write(" max ");
+		serial_write_number(irq_stats_clamp(stat.max_duration), 10);
+		serial_write("\n");
+		irq_stats_dump_histogram("  latency ", stat.latency);
+		irq_stats_dump_histogram("  duration", stat.duration);
+	}
+
+	serial_write("Top offenders (>= ");
+	serial_write_number(IRQ_STATS_SLOW_CYCLES, 10);
+	serial_write(" cycles)\n");
+	for (uint32_t i = 0; i < IRQ_STATS_OFFENDERS; ++i)
+	{
+		struct irq_offender offender;
+		uint32_t flags = local_irq_save();
+		offender = offenders[i];
+		local_irq_restore(flags);
+
+		if (!offender.duration)
+			continue;
+
+		serial_write("  vector ");
+		serial_write_number(offender.vector, 16);
+		serial_write(" handler ");
+		serial_write_number(offender.handler, 16);
+		serial_write(" eip ");
+		serial_write_number(offender.eip, 16);
+		serial_write(" at ");
+		serial_write_number(offender.jiffies, 10);
+		serial_write("ms cycles ");
+		serial_write_number(irq_stats_clamp(offender.duration), 10);
+		serial_write("\n");
+	}
+}
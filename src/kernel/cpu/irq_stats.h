@@ -0,0 +1,36 @@
+#ifndef CPU_IRQ_STATS_H
+#define CPU_IRQ_STATS_H
+
+#include <stdint.h>
+
+// histogram bucket n counts samples in [2^n, 2^(n+1)) cycles, the last one everything above
+#define IRQ_STATS_BUCKETS 24
+#define IRQ_STATS_OFFENDERS 8
+// handlers running longer than this are logged as offenders (~100us at 1GHz)
+#define IRQ_STATS_SLOW_CYCLES 100000
+
+struct irq_stat
+{
+	uint32_t latency[IRQ_STATS_BUCKETS];   // stub entry -> handler
+	uint32_t duration[IRQ_STATS_BUCKETS];  // handler runtime
+	uint64_t max_duration;
+};
+
+struct irq_offender
+{
+	uint8_t vector;
+	uint32_t handler;
+	uint32_t eip;  // interrupted instruction
+	uint32_t jiffies;
+	uint64_t duration;
+};
+
+extern volatile uint64_t irq_entry_tsc;
+// per-vector call count, kept apart so the direct stubs can bump it without the histograms
+extern volatile uint32_t irq_counts[];
+
+void irq_stats_record(uint8_t vector, uint32_t handler, uint32_t eip, uint64_t entry, uint64_t start, uint64_t end);
+void irq_stats_reset();
+void irq_stats_dump();
+
+#endif
@@ -1,43 +1,119 @@
 #include "pit.h"
 
-#include <cpu/rtc.h>
 #include <include/list.h>
 #include <memory/vmm.h>
 #include <utils/debug.h>
+#include <utils/math.h>
 
+#include "clockevents.h"
 #include "idt.h"
 #include "pic.h"
+#include "tick.h"
 
 #define PIT_REG_COUNTER 0x40
 #define PIT_REG_COMMAND 0x43
-#define PIT_TICKS_PER_SECOND 1000
+#define PIT_FREQUENCY 1193182
+#define PIT_LATCH (PIT_FREQUENCY / HZ)
+#define PIT_MAX_COUNT 0xffff
 
-extern volatile uint32_t boot_seconds, current_seconds;
+#define PIT_MODE_ONESHOT 0x30	 // channel 0, lobyte/hibyte, mode 0 (interrupt on terminal count)
+#define PIT_MODE_PERIODIC 0x34	 // channel 0, lobyte/hibyte, mode 2 (rate generator)
 
-volatile uint32_t jiffies = 0;	// in milliseconds
+static uint32_t pit_programmed;	 // count loaded by the last periodic or one-shot setup
+static bool pit_fired;
 
-// boot_seconds is only set on the first tick
-// current_seconds are updated each tick in rtc irq handler
-// each half second in pit (why? one second with latency is already in the frame)
-// -> if there is a latency due to overhead in other interrupts <-> jiffies < (current_seconds - boot_seconds) * 100
-// -> jiffies = (current_seconds - boot_seconds) * 1000
-static int32_t pit_interrupt_handler(struct interrupt_registers *regs)
+// ~0.001% off, but stays in 32 bits for every 16 bit count
+static uint32_t pit_ticks_to_us(uint32_t ticks)
 {
-	if (!jiffies)
-	{
-		struct time boot_time;
-		rtc_get_datetime(&boot_time.year, &boot_time.month, &boot_time.day,
-						 &boot_time.hour, &boot_time.minute, &boot_time.second);
-		set_boot_seconds(get_seconds(&boot_time));
-	}
+	return ticks * 8381 / 10000;
+}
+
+// us * 1193182 leaves 32 bits above ~3.6 ms
+static uint32_t pit_us_to_ticks(uint32_t us)
+{
+	return div_u64((uint64_t)us * PIT_FREQUENCY, 1000000);
+}
+
+static void pit_load_counter(uint32_t count)
+{
+	outportb(PIT_REG_COUNTER, count & 0xff);
+	outportb(PIT_REG_COUNTER, (count >> 8) & 0xff);
+}
+
+static uint32_t pit_read_counter()
+{
+	outportb(PIT_REG_COMMAND, 0x00);  // latch channel 0
+	uint32_t count = inportb(PIT_REG_COUNTER);
+	count |= inportb(PIT_REG_COUNTER) << 8;
+	return count;
+}
+
+static void pit_set_periodic(struct clock_event_device *dev)
+{
+	outportb(PIT_REG_COMMAND, PIT_MODE_PERIODIC);
+	pit_load_counter(PIT_LATCH);
+	pit_programmed = PIT_LATCH;
+}
+
+// writing the mode 0 control word stops the counter until a new count is loaded
+static void pit_set_oneshot(struct clock_event_device *dev)
+{
+	outportb(PIT_REG_COMMAND, PIT_MODE_ONESHOT);
+}
 
-	jiffies++;
-	// adjust ticks due to overhead and latency
-	if (jiffies % (PIT_TICKS_PER_SECOND / 2) == 0 && jiffies < (current_seconds - boot_seconds) * 1000)
-		jiffies = (current_seconds - boot_seconds) * 1000;
+static void pit_shutdown(struct clock_event_device *dev)
+{
+	outportb(PIT_REG_COMMAND, PIT_MODE_ONESHOT);
+	pit_programmed = 0;
+}
+
+static int32_t pit_set_next_event(uint32_t delta_us, struct clock_event_device *dev)
+{
+	uint32_t ticks = pit_us_to_ticks(delta_us);
+	if (ticks > PIT_MAX_COUNT)
+		ticks = PIT_MAX_COUNT;
+
+	pit_fired = false;
+	pit_programmed = ticks;
+	pit_load_counter(ticks);
+	return 0;
+}
+
+static uint32_t pit_get_elapsed_us(struct clock_event_device *dev)
+{
+	// in mode 0 the counter wraps around after the terminal count
+	if (dev->state == CLOCK_EVT_STATE_ONESHOT && pit_fired)
+		return pit_ticks_to_us(pit_programmed);
 
+	uint32_t count = pit_read_counter();
+	if (count > pit_programmed)
+		return pit_ticks_to_us(pit_programmed);
+	return pit_ticks_to_us(pit_programmed - count);
+}
+
+static struct clock_event_device pit_clockevent = {
+	.name = "pit",
+	.features = CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT,
+	.rating = 100,
+	.min_delta_us = 1,
+	.max_delta_us = PIT_MAX_COUNT * 8381 / 10000,
+	.set_next_event = pit_set_next_event,
+	.set_state_periodic = pit_set_periodic,
+	.set_state_oneshot = pit_set_oneshot,
+	.set_state_shutdown = pit_shutdown,
+	.get_elapsed_us = pit_get_elapsed_us,
+};
+
+// NOTE: irq0 has its own stub in interrupt.asm which calls this directly
+int32_t timer_interrupt(struct interrupt_registers *regs)
+{
 	irq_ack(regs->int_no);
 
+	if (pit_clockevent.state == CLOCK_EVT_STATE_ONESHOT)
+		pit_fired = true;
+	if (pit_clockevent.event_handler)
+		pit_clockevent.event_handler(&pit_clockevent);
+
 	return IRQ_HANDLER_CONTINUE;
 }
 
@@ -45,17 +121,13 @@ static int32_t pit_interrupt_handler(struct interrupt_registers *regs)
 // Prefer using rtc instead of pit for scheduling stuffs which don't require much accuracy
 // (timer_list for example), because we allow overhead and latency in rtc irq
 // pit should only be used for keeping track of time precision
+// NOTE: timer_list now runs off the tick (see timer.c), whichever clock event device drives it
 void pit_init()
 {
 	serial_write("PIT: Initializing\n");
 
-	int divisor = 1193181 / PIT_TICKS_PER_SECOND;
-
-	outportb(PIT_REG_COMMAND, 0x34);
-	outportb(PIT_REG_COUNTER, divisor & 0xff);
-	outportb(PIT_REG_COUNTER, (divisor >> 8) & 0xff);
-
-	register_interrupt_handler(IRQ0, pit_interrupt_handler);
+	clockevents_register_device(&pit_clockevent);
+	irq_clear_mask(0);
 
 	serial_write("PIT: Done\n");
-}
\ No newline at end of file
+}
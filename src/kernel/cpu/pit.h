@@ -6,5 +6,6 @@
 #include "idt.h"
 
 void pit_init();
+int32_t timer_interrupt(struct interrupt_registers *regs);
 
 #endif
\ No newline at end of file
@@ -2,26 +2,31 @@
 
 #include <cpu/hal.h>
 #include <cpu/idt.h>
-#include <cpu/pic.h>
+#include <cpu/clocksource.h>
+#include <cpu/tick.h>
+#include <cpu/timer.h>
 #include <utils/debug.h>
 #include <utils/math.h>
 
 #define CMOS_ADDRESS 0x70
 #define CMOS_DATA 0x71
-#define RTC_TICKS_PER_SECOND 32
+// cmos only counts whole seconds, smaller differences are just the read granularity
+#define RTC_SYNC_INTERVAL (60 * HZ)
+#define RTC_SYNC_THRESHOLD 2
 
-static volatile uint32_t current_ticks = 0;
-
-static uint8_t rtc_get_update_flag()
+// the index and the read must not be split by anything else touching cmos
+static uint8_t rtc_get_register(uint32_t reg)
 {
-	outportb(CMOS_ADDRESS, 0x0A);
-	return inportb(CMOS_DATA) & 0x80;
+	uint32_t flags = local_irq_save();
+	outportb(CMOS_ADDRESS, reg);
+	uint8_t value = inportb(CMOS_DATA);
+	local_irq_restore(flags);
+	return value;
 }
 
-static uint8_t rtc_get_register(uint32_t reg)
+static uint8_t rtc_get_update_flag()
 {
-	outportb(CMOS_ADDRESS, reg);
-	return inportb(CMOS_DATA);
+	return rtc_get_register(0x0A) & 0x80;
 }
 
 void rtc_get_datetime(uint16_t *year, uint8_t *month, uint8_t *day,
@@ -85,49 +90,53 @@ void rtc_get_datetime(uint16_t *year, uint8_t *month, uint8_t *day,
 	}
 }
 
-static int32_t rtc_irq_handler(struct interrupt_registers *regs)
-{
-	current_ticks++;
+static void rtc_sync(struct timer_list *timer);
 
-	if (current_ticks % (RTC_TICKS_PER_SECOND / 4) == 0)
-	{
-		uint16_t year;
-		uint8_t second, minute, hour, day, month;
+static struct timer_list rtc_sync_timer = TIMER_INITIALIZER(rtc_sync, 0);
 
-		rtc_get_datetime(&year, &month, &day, &hour, &minute, &second);
-		set_current_time(year, month, day, hour, minute, second);
-	}
+static uint32_t rtc_read_seconds()
+{
+	struct time t;
+	rtc_get_datetime(&t.year, &t.month, &t.day, &t.hour, &t.minute, &t.second);
+	return get_seconds(&t);
+}
 
-	outportb(0x70, 0x0C);  // select register C
-	inportb(0x71);		   // just throw away contents
+// NOTE: Runs from the timer softirq with interrupts enabled. The monotonic clock is the time base,
+// cmos is only compared against it and wins when they drift apart by more than its resolution
+static void rtc_sync(struct timer_list *timer)
+{
+	uint32_t cmos_seconds = rtc_read_seconds();
+	int32_t drift = cmos_seconds - get_seconds(NULL);
 
-	irq_ack(regs->int_no);
-	return IRQ_HANDLER_CONTINUE;
+	if (drift >= RTC_SYNC_THRESHOLD || drift <= -RTC_SYNC_THRESHOLD)
+		timekeeping_settime(cmos_seconds);
+
+	mod_timer(timer, jiffies + RTC_SYNC_INTERVAL);
 }
 
+// NOTE: Wall time is read from cmos once here and then kept by the monotonic clock, the rtc
+// periodic interrupt is switched off so the cpu isn't woken 32 times a second for it
 void rtc_init()
 {
 	serial_write("RTC: Initializing\n");
 
-	uint8_t rate = log2(32768 / RTC_TICKS_PER_SECOND) + 1;
-	disable_interrupts();
-	outportb(0x70, 0x8A);		  // select Status Register A, and disable NMI (by setting the 0x80 bit)
-	outportb(0x71, 0x20 | rate);  // write to CMOS/RTC RAM and interrupt rate
+	uint32_t flags = local_irq_save();
+	outportb(0x70, 0x8B);		   // select register B, and disable NMI
+	char prev = inportb(0x71);	   // read the current value of register B
+	outportb(0x70, 0x8B);		   // set the index again (a read will reset the index to register D)
+	outportb(0x71, prev & ~0x40);  // clear bit 6 of register B, no periodic interrupt
+	outportb(0x70, 0x0C);		   // drop a pending interrupt by reading register C
+	inportb(0x71);
+	outportb(0x70, 0x0D);		   // re-enable NMI
+	inportb(0x71);
+	local_irq_restore(flags);
 
-	// turn on irq8
-	outportb(0x70, 0x8B);		  // select register B, and disable NMI
-	char prev = inportb(0x71);	  // read the current value of register B
-	outportb(0x70, 0x8B);		  // set the index again (a read will reset the index to register D)
-	outportb(0x71, prev | 0x40);  // write the previous value ORed with 0x40. This turns on bit 6 of register B
-	register_interrupt_handler(IRQ8, rtc_irq_handler);
-	pic_clear_mask(IRQ8);
+	timekeeping_settime(rtc_read_seconds());
+	mod_timer(&rtc_sync_timer, jiffies + RTC_SYNC_INTERVAL);
 
 	serial_write("RTC: Done\n");
 }
 
-extern volatile uint32_t jiffies;
-
-volatile uint32_t boot_seconds, current_seconds;
 struct time epoch_time = {
 	.year = 1970,
 	.month = 1,
@@ -136,29 +145,30 @@ struct time epoch_time = {
 	.minute = 0,
 	.second = 0,
 };
-struct time current_time;
 
 void set_boot_seconds(uint64_t bs)
 {
-	boot_seconds = bs;
+	timekeeping_set_boot_seconds(bs);
 }
 
+// set the wall clock, the monotonic clock keeps it going from there
 void set_current_time(uint16_t year, uint8_t month, uint8_t day,
 					  uint8_t hour, uint8_t minute, uint8_t second)
 {
-	current_time.year = year;
-	current_time.month = month;
-	current_time.day = day;
-	current_time.hour = hour;
-	current_time.minute = minute;
-	current_time.second = second;
-	current_seconds = get_seconds(NULL);
+	struct time t = {
+		.year = year,
+		.month = month,
+		.day = day,
+		.hour = hour,
+		.minute = minute,
+		.second = second,
+	};
+	timekeeping_settime(get_seconds(&t));
 }
 
 // NOTE: MQ 2019-07-25 According to this paper http://howardhinnant.github.io/date_algorithms.html#civil_from_days
-static struct time *get_time_from_seconds(int32_t seconds)
+static void time_from_seconds(int32_t seconds, struct time *t)
 {
-	struct time *t = kcalloc(1, sizeof(struct time));
 	int32_t days = seconds / (24 * 3600);
 
 	days += 719468;
@@ -177,8 +187,6 @@ static struct time *get_time_from_seconds(int32_t seconds)
 	t->hour = (seconds % (24 * 3600)) / 3600;
 	t->minute = (seconds % (60 * 60)) / 60;
 	t->second = seconds % 60;
-
-	return t;
 }
 
 // NOTE: MQ 2019-07-25 According to this paper http://howardhinnant.github.io/date_algorithms.html#days_from_civil
@@ -200,22 +208,27 @@ static uint32_t get_days(struct time *t)
 uint32_t get_seconds(struct time *t)
 {
 	if (t == NULL)
-		t = &current_time;
+		return div_u64(ktime_get_real_ns(), NSEC_PER_SEC);
 
 	return get_days(t) * 24 * 3600 + t->hour * 3600 + t->minute * 60 + t->second;
 }
 
 uint64_t get_milliseconds(struct time *t)
 {
+	uint64_t now_ms = div_u64(ktime_get_real_ns(), NSEC_PER_MSEC);
+
 	if (t == NULL)
-		return boot_seconds * 1000 + jiffies;
+		return now_ms;
 	else
-		return get_seconds(t) * 1000 + jiffies % 1000;
+		return (uint64_t)get_seconds(t) * 1000 + now_ms % 1000;
 }
 
-struct time *get_time(int32_t seconds)
+// NOTE: Fills the caller's buffer, 0 seconds means now. Neither allocates nor locks so it is
+// safe from interrupt context
+struct time *get_time(int32_t seconds, struct time *t)
 {
-	return seconds == 0 ? &current_time : get_time_from_seconds(seconds);
+	time_from_seconds(seconds ? seconds : (int32_t)get_seconds(NULL), t);
+	return t;
 }
 
 uint64_t get_milliseconds_since_epoch()
@@ -23,5 +23,5 @@ void set_current_time(uint16_t year, uint8_t month, uint8_t day,
 uint32_t get_seconds(struct time *);
 uint64_t get_milliseconds(struct time *t);
 uint64_t get_milliseconds_since_epoch();
-struct time *get_time(int32_t seconds);
+struct time *get_time(int32_t seconds, struct time *t);
 #endif
\ No newline at end of file
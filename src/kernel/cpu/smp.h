@@ -0,0 +1,15 @@
+#ifndef CPU_SMP_H
+#define CPU_SMP_H
+
+#include <stdint.h>
+
+// NOTE: Only the bootstrap processor is brought up for now, per-cpu data is
+// still indexed by smp_processor_id() so it is ready once application processors are
+#define NR_CPUS 1
+
+static inline uint32_t smp_processor_id()
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#include "softirq.h"
+
+#include <utils/debug.h>
+
+#include "hal.h"
+#include "smp.h"
+
+// give up after this many rounds, whatever is still pending runs on the next irq exit
+#define MAX_SOFTIRQ_RESTART 10
+
+struct tasklet_list
+{
+	struct tasklet_struct *head;
+	struct tasklet_struct **tail;
+};
+
+struct softirq_cpu
+{
+	volatile uint32_t pending;
+	uint32_t hardirq_nesting;
+	bool softirq_running;
+	struct tasklet_list tasklets;
+	struct tasklet_list hi_tasklets;
+};
+
+static void (*softirq_vec[NR_SOFTIRQS])();
+static struct softirq_cpu softirq_cpus[NR_CPUS];
+
+void open_softirq(uint32_t nr, void (*action)())
+{
+	softirq_vec[nr] = action;
+}
+
+void raise_softirq(uint32_t nr)
+{
+	uint32_t flags = local_irq_save();
+	softirq_cpus[smp_processor_id()].pending |= 1 << nr;
+	local_irq_restore(flags);
+}
+
+bool in_interrupt()
+{
+	struct softirq_cpu *cpu = &softirq_cpus[smp_processor_id()];
+	return cpu->hardirq_nesting || cpu->softirq_running;
+}
+
+// NOTE: Softirqs run with interrupts enabled, so a device can interrupt a running bottom half.
+// Nested irqs see softirq_running and leave the pending work to the outermost caller
+void do_softirq()
+{
+	struct softirq_cpu *cpu = &softirq_cpus[smp_processor_id()];
+	uint32_t flags = local_irq_save();
+
+	if (in_interrupt() || !cpu->pending)
+	{
+		local_irq_restore(flags);
+		return;
+	}
+
+	cpu->softirq_running = true;
+	for (int restart = MAX_SOFTIRQ_RESTART; cpu->pending && restart > 0; --restart)
+	{
+		uint32_t pending = cpu->pending;
+		cpu->pending = 0;
+
+		enable_interrupts();
+		while (pending)
+		{
+			uint32_t nr = __builtin_ctz(pending);
+			pending &= pending - 1;
+			if (softirq_vec[nr])
+				softirq_vec[nr]();
+		}
+		disable_interrupts();
+	}
+	cpu->softirq_running = false;
+
+	local_irq_restore(flags);
+}
+
+// called with interrupts disabled on the way in and out of hard irq handlers
+void irq_enter()
+{
+	softirq_cpus[smp_processor_id()].hardirq_nesting++;
+}
+
+void irq_exit()
+{
+	struct softirq_cpu *cpu = &softirq_cpus[smp_processor_id()];
+
+	cpu->hardirq_nesting--;
+	if (!in_interrupt() && cpu->pending)
+		do_softirq();
+}
+
+static void tasklet_list_add(struct tasklet_list *list, struct tasklet_struct *t)
+{
+	t->next = NULL;
+	*list->tail = t;
+	list->tail = &t->next;
+}
+
+static void tasklet_action_common(struct tasklet_list *list)
+{
+	disable_interrupts();
+	struct tasklet_struct *t = list->head;
+	list->head = NULL;
+	list->tail = &list->head;
+	enable_interrupts();
+
+	while (t)
+	{
+		struct tasklet_struct *next = t->next;
+
+		// clear first, so the tasklet may schedule itself again
+		t->state &= ~TASKLET_STATE_SCHED;
+		t->func(t->data);
+
+		t = next;
+	}
+}
+
+static void tasklet_action()
+{
+	tasklet_action_common(&softirq_cpus[smp_processor_id()].tasklets);
+}
+
+static void tasklet_hi_action()
+{
+	tasklet_action_common(&softirq_cpus[smp_processor_id()].hi_tasklets);
+}
+
+void tasklet_init(struct tasklet_struct *t, void (*func)(uint32_t data), uint32_t data)
+{
+	t->next = NULL;
+	t->state = 0;
+	t->func = func;
+	t->data = data;
+}
+
+static void __tasklet_schedule(struct tasklet_struct *t, struct tasklet_list *list, uint32_t nr)
+{
+	uint32_t flags = local_irq_save();
+	// a tasklet which is already queued only runs once
+	if (!(t->state & TASKLET_STATE_SCHED))
+	{
+		t->state |= TASKLET_STATE_SCHED;
+		tasklet_list_add(list, t);
+		softirq_cpus[smp_processor_id()].pending |= 1 << nr;
+	}
+	local_irq_restore(flags);
+}
+
+void tasklet_schedule(struct tasklet_struct *t)
+{
+	__tasklet_schedule(t, &softirq_cpus[smp_processor_id()].tasklets, TASKLET_SOFTIRQ);
+}
+
+void tasklet_hi_schedule(struct tasklet_struct *t)
+{
+	__tasklet_schedule(t, &softirq_cpus[smp_processor_id()].hi_tasklets, HI_SOFTIRQ);
+}
+
+void softirq_init()
+{
+	serial_write("SOFTIRQ: Initializing\n");
+
+	for (uint32_t i = 0; i < NR_CPUS; ++i)
+	{
+		softirq_cpus[i].tasklets.tail = &softirq_cpus[i].tasklets.head;
+		softirq_cpus[i].hi_tasklets.tail = &softirq_cpus[i].hi_tasklets.head;
+	}
+
+	open_softirq(HI_SOFTIRQ, tasklet_hi_action);
+	open_softirq(TASKLET_SOFTIRQ, tasklet_action);
+
+	serial_write("SOFTIRQ: Done\n");
+}
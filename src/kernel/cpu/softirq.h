@@ -0,0 +1,41 @@
+#ifndef CPU_SOFTIRQ_H
+#define CPU_SOFTIRQ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// lower numbers run first
+enum
+{
+	HI_SOFTIRQ,
+	TIMER_SOFTIRQ,
+	TASKLET_SOFTIRQ,
+	NR_SOFTIRQS,
+};
+
+#define TASKLET_STATE_SCHED 0x1
+
+struct tasklet_struct
+{
+	struct tasklet_struct *next;
+	uint32_t state;
+	void (*func)(uint32_t data);
+	uint32_t data;
+};
+
+#define DECLARE_TASKLET(name, _func, _data) \
+	struct tasklet_struct name = {.next = NULL, .state = 0, .func = _func, .data = _data}
+
+void softirq_init();
+void open_softirq(uint32_t nr, void (*action)());
+void raise_softirq(uint32_t nr);
+void do_softirq();
+void irq_enter();
+void irq_exit();
+bool in_interrupt();
+
+void tasklet_init(struct tasklet_struct *t, void (*func)(uint32_t data), uint32_t data);
+void tasklet_schedule(struct tasklet_struct *t);
+void tasklet_hi_schedule(struct tasklet_struct *t);
+
+#endif
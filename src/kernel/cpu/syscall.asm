@@ -0,0 +1,51 @@
+[extern syscall_table]
+
+%define NR_SYSCALLS 256
+%define ENOSYS 38
+
+; SYSENTER fast path
+; The processor loads cs/ss from IA32_SYSENTER_CS and esp/eip from the
+; other two MSRs, nothing is saved and interrupts are off. esp points at
+; tss.esp0, so the first thing to do is to switch to the real kernel stack.
+[global sysenter_entry]
+sysenter_entry:
+    mov esp, [esp]
+
+    push ecx ; user esp
+    push edx ; user eip
+
+    ; only ds and es are used by kernel code, fs and gs are left alone
+    mov dx, 0x10
+    mov ds, dx
+    mov es, dx
+
+    ; arguments, in cdecl order. There is no register left for a fifth one,
+    ; handlers always get 0 there on this path
+    push dword 0
+    push ebp
+    push edi
+    push esi
+    push ebx
+
+    sti
+    cld
+    cmp eax, NR_SYSCALLS
+    jae .bad_syscall
+    call [syscall_table + eax * 4]
+.done:
+    ; ebx, esi, edi and ebp are callee saved, the pushed copies are only arguments
+    add esp, 20
+
+    cli
+    mov dx, 0x23
+    mov ds, dx
+    mov es, dx
+
+    pop edx
+    pop ecx
+    sti ; takes effect after sysexit, no interrupt can land in between
+    sysexit
+
+.bad_syscall:
+    mov eax, -ENOSYS
+    jmp .done
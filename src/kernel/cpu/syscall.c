@@ -0,0 +1,63 @@
+#include "syscall.h"
+
+#include <include/errno.h>
+#include <utils/debug.h>
+
+#include "hal.h"
+#include "idt.h"
+#include "tss.h"
+
+extern void sysenter_entry();
+
+static int32_t sys_ni_syscall(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5)
+{
+	return -ENOSYS;
+}
+
+// indexed directly by both entry paths, unused slots return -ENOSYS
+syscall_fn syscall_table[NR_SYSCALLS] = {
+	[0 ... NR_SYSCALLS - 1] = sys_ni_syscall,
+};
+
+void register_syscall(uint32_t nr, syscall_fn fn)
+{
+	if (nr < NR_SYSCALLS)
+		syscall_table[nr] = fn;
+}
+
+// the int 0x7F fallback, for processors without sysenter
+static int32_t syscall_dispatcher(struct interrupt_registers *regs)
+{
+	if (regs->eax >= NR_SYSCALLS)
+	{
+		regs->eax = -ENOSYS;
+		return IRQ_HANDLER_CONTINUE;
+	}
+
+	regs->eax = syscall_table[regs->eax](regs->ebx, regs->ecx, regs->edx, regs->esi, regs->edi);
+	return IRQ_HANDLER_CONTINUE;
+}
+
+void syscall_init()
+{
+	serial_write("SYSCALL: Initializing\n");
+
+	register_interrupt_handler(DISPATCHER_ISR, syscall_dispatcher);
+
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	uint32_t model = (eax >> 4) & 0xf, family = (eax >> 8) & 0xf, stepping = eax & 0xf;
+
+	// NOTE: The SEP bit is bogus on the Pentium Pro (family 6, model < 3, stepping < 3)
+	if ((edx & (1 << 11)) && !(family == 6 && model < 3 && stepping < 3))
+	{
+		// cs = 0x08, ss = 0x10; sysexit returns to 0x18 | 3 and 0x20 | 3
+		wrmsr(IA32_SYSENTER_CS, 0x08);
+		// the entry loads esp from tss.esp0, which always holds the running thread's kernel stack
+		wrmsr(IA32_SYSENTER_ESP, (uint32_t)tss_get_esp0());
+		wrmsr(IA32_SYSENTER_EIP, (uint32_t)sysenter_entry);
+		serial_write("SYSCALL: sysenter enabled\n");
+	}
+
+	serial_write("SYSCALL: Done\n");
+}
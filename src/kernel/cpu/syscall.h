@@ -0,0 +1,27 @@
+#ifndef CPU_SYSCALL_H
+#define CPU_SYSCALL_H
+
+#include <stdint.h>
+
+#define NR_SYSCALLS 256
+
+#define IA32_SYSENTER_CS 0x174
+#define IA32_SYSENTER_ESP 0x175
+#define IA32_SYSENTER_EIP 0x176
+
+/*
+  System call convention
+  int 0x7F: eax = number, arguments in ebx, ecx, edx, esi, edi
+  sysenter: eax = number, arguments in ebx, esi, edi, ebp,
+			ecx = user esp and edx = user eip to return to (sysexit takes them from there)
+			only four arguments fit, arg5 is always 0; calls with five arguments must use int 0x7F
+  The result comes back in eax, every other register except ecx and edx is preserved
+*/
+typedef int32_t (*syscall_fn)(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
+
+extern syscall_fn syscall_table[NR_SYSCALLS];
+
+void syscall_init();
+void register_syscall(uint32_t nr, syscall_fn fn);
+
+#endif
@@ -0,0 +1,145 @@
+#include "tick.h"
+
+#include <utils/debug.h>
+
+#include "clocksource.h"
+#include "hal.h"
+#include "softirq.h"
+#include "timer.h"
+
+volatile uint32_t jiffies = 0;	// in milliseconds
+
+static struct clock_event_device *tick_device;
+static uint32_t (*next_event_hooks[TICK_NEXT_EVENT_HOOKS])();
+static uint32_t tick_remainder_us;	// time accounted but not yet a whole jiffy
+static uint32_t tick_programmed_us;	// one-shot delay which has not expired yet
+static bool tick_stopped;
+
+static void tick_account_us(uint32_t us)
+{
+	tick_remainder_us += us;
+	jiffies += tick_remainder_us / TICK_USEC;
+	tick_remainder_us %= TICK_USEC;
+}
+
+static void tick_handle_periodic(struct clock_event_device *dev)
+{
+	jiffies++;
+	timekeeping_update();
+	run_local_timers();
+}
+
+// the one-shot programmed on idle entry expired
+static void tick_nohz_handler(struct clock_event_device *dev)
+{
+	tick_account_us(tick_programmed_us);
+	tick_programmed_us = 0;
+	timekeeping_update();
+	run_local_timers();
+}
+
+void tick_setup_device(struct clock_event_device *dev)
+{
+	tick_device = dev;
+	tick_stopped = false;
+	dev->event_handler = tick_handle_periodic;
+	clockevents_switch_state(dev, CLOCK_EVT_STATE_PERIODIC);
+}
+
+// NOTE: Subsystems with pending timers (the timer wheel for example) report how far away their
+// next expiry is, so an idle cpu sleeps exactly until then
+void tick_register_next_event(uint32_t (*next_event_us)())
+{
+	for (uint32_t i = 0; i < TICK_NEXT_EVENT_HOOKS; ++i)
+		if (!next_event_hooks[i])
+		{
+			next_event_hooks[i] = next_event_us;
+			return;
+		}
+	assert_not_reached();
+}
+
+static uint32_t tick_next_event()
+{
+	uint32_t next = TICK_NO_EVENT;
+	for (uint32_t i = 0; i < TICK_NEXT_EVENT_HOOKS && next_event_hooks[i]; ++i)
+	{
+		uint32_t event = next_event_hooks[i]();
+		if (event < next)
+			next = event;
+	}
+	return next;
+}
+
+bool tick_nohz_tick_stopped()
+{
+	return tick_stopped;
+}
+
+// called with interrupts disabled right before halting
+void tick_nohz_idle_enter()
+{
+	struct clock_event_device *dev = tick_device;
+	if (!dev || !(dev->features & CLOCK_EVT_FEAT_ONESHOT) || tick_stopped)
+		return;
+
+	uint32_t next = tick_next_event();
+	if (next <= TICK_USEC)
+		return;
+
+	if (next > dev->max_delta_us)
+		next = dev->max_delta_us;
+
+	// part of the current period is already gone, it won't be ticked anymore
+	tick_account_us(dev->get_elapsed_us(dev));
+
+	dev->event_handler = tick_nohz_handler;
+	clockevents_switch_state(dev, CLOCK_EVT_STATE_ONESHOT);
+	tick_programmed_us = next;
+	tick_stopped = true;
+
+	// the deadline passed while programming it, keep ticking instead of sleeping forever
+	if (dev->set_next_event(next, dev))
+	{
+		tick_programmed_us = 0;
+		tick_stopped = false;
+		dev->event_handler = tick_handle_periodic;
+		clockevents_switch_state(dev, CLOCK_EVT_STATE_PERIODIC);
+	}
+}
+
+// called with interrupts disabled after waking up, whatever woke us
+void tick_nohz_idle_exit()
+{
+	struct clock_event_device *dev = tick_device;
+	if (!tick_stopped)
+		return;
+
+	// woken early by another irq, only part of the one-shot has passed
+	if (tick_programmed_us)
+	{
+		uint32_t elapsed = dev->get_elapsed_us(dev);
+		tick_account_us(elapsed < tick_programmed_us ? elapsed : tick_programmed_us);
+		tick_programmed_us = 0;
+	}
+
+	tick_stopped = false;
+	dev->event_handler = tick_handle_periodic;
+	clockevents_switch_state(dev, CLOCK_EVT_STATE_PERIODIC);
+}
+
+// NOTE: sti only takes effect after the next instruction, so an irq can't slip in between the
+// checks and hlt and leave us sleeping with the tick stopped
+void cpu_idle()
+{
+	for (;;)
+	{
+		disable_interrupts();
+		tick_nohz_idle_enter();
+		asm volatile("sti\n"
+					 "hlt");
+		disable_interrupts();
+		tick_nohz_idle_exit();
+		enable_interrupts();
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef CPU_TICK_H
+#define CPU_TICK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "clockevents.h"
+
+#define HZ 1000
+#define TICK_USEC (1000000 / HZ)
+#define TICK_NEXT_EVENT_HOOKS 4
+#define TICK_NO_EVENT 0xffffffff
+
+extern volatile uint32_t jiffies;  // in milliseconds
+
+void tick_setup_device(struct clock_event_device *dev);
+void tick_register_next_event(uint32_t (*next_event_us)());
+void tick_nohz_idle_enter();
+void tick_nohz_idle_exit();
+bool tick_nohz_tick_stopped();
+void cpu_idle();
+
+#endif
@@ -0,0 +1,246 @@
+#include "timer.h"
+
+#include <utils/debug.h>
+#include <utils/math.h>
+
+#include "hal.h"
+#include "smp.h"
+#include "softirq.h"
+#include "tick.h"
+
+/*
+  Hierarchical timer wheel
+  tv1 has one slot per jiffy for the next 256 jiffies, each of tv2..tv5 covers 64 times the range
+  of the level below it. Slots are indexed by the absolute expiry bits, so adding and cancelling a
+  timer is a list operation. Whenever tv1 wraps, the matching slot of tv2 is cascaded down (and so
+  on upwards), which spreads timers far in the future over the finer levels only when they get close
+  level  slots  jiffies per slot  range
+  tv1    256    1                 256 ms
+  tv2    64     256               ~16 s
+  tv3    64     16384             ~17 min
+  tv4    64     1048576           ~18 h
+  tv5    64     67108864          ~49 days
+*/
+struct tvec_base
+{
+	uint32_t timer_jiffies;	 // the next jiffy to process
+	uint32_t pending;		 // number of armed timers
+	uint32_t tv1_bitmap[TVR_SIZE / 32];	// non-empty tv1 slots, a bit may stay set after del_timer
+	struct list_head tv1[TVR_SIZE];
+	struct list_head tv2[TVN_SIZE];
+	struct list_head tv3[TVN_SIZE];
+	struct list_head tv4[TVN_SIZE];
+	struct list_head tv5[TVN_SIZE];
+};
+
+#define INDEX(N) ((base->timer_jiffies >> (TVR_BITS + (N)*TVN_BITS)) & TVN_MASK)
+
+static struct tvec_base tvec_bases[NR_CPUS];
+
+static struct list_head *tv1_slot(struct tvec_base *base, uint32_t slot)
+{
+	base->tv1_bitmap[slot / 32] |= 1u << (slot % 32);
+	return base->tv1 + slot;
+}
+
+static void internal_add_timer(struct tvec_base *base, struct timer_list *timer)
+{
+	uint32_t expires = timer->expires;
+	uint32_t idx = expires - base->timer_jiffies;
+	struct list_head *vec;
+
+	if (idx < TVR_SIZE)
+		vec = tv1_slot(base, expires & TVR_MASK);
+	else if (idx < 1 << (TVR_BITS + TVN_BITS))
+		vec = base->tv2 + ((expires >> TVR_BITS) & TVN_MASK);
+	else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS))
+		vec = base->tv3 + ((expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK);
+	else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS))
+		vec = base->tv4 + ((expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK);
+	else if ((int32_t)idx < 0)
+		// already expired, run it with the next processed jiffy
+		vec = tv1_slot(base, base->timer_jiffies & TVR_MASK);
+	else
+		// idx < 2^31 here, tv5 covers the whole 32 bit range
+		vec = base->tv5 + ((expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK);
+
+	list_add_tail(&timer->entry, vec);
+	base->pending++;
+}
+
+static void detach_timer(struct tvec_base *base, struct timer_list *timer)
+{
+	list_del(&timer->entry);
+	base->pending--;
+}
+
+// move every timer of a higher level slot down to where it belongs now
+static uint32_t cascade(struct tvec_base *base, struct list_head *tv, uint32_t index)
+{
+	struct list_head tv_list;
+	struct timer_list *timer, *tmp;
+
+	list_replace_init(tv + index, &tv_list);
+	list_for_each_entry_safe(timer, tmp, &tv_list, entry)
+	{
+		base->pending--;
+		internal_add_timer(base, timer);
+	}
+
+	return index;
+}
+
+void timer_setup(struct timer_list *timer, void (*function)(struct timer_list *timer))
+{
+	timer->entry.next = NULL;
+	timer->entry.prev = NULL;
+	timer->expires = 0;
+	timer->function = function;
+}
+
+void add_timer(struct timer_list *timer)
+{
+	assert(!timer_pending(timer));
+	mod_timer(timer, timer->expires);
+}
+
+// (re)arm the timer, returns whether it was pending before
+bool mod_timer(struct timer_list *timer, uint32_t expires)
+{
+	struct tvec_base *base = &tvec_bases[smp_processor_id()];
+	uint32_t flags = local_irq_save();
+
+	bool pending = timer_pending(timer);
+	if (pending)
+		detach_timer(base, timer);
+
+	timer->expires = expires;
+	internal_add_timer(base, timer);
+
+	local_irq_restore(flags);
+	return pending;
+}
+
+// returns whether the timer was pending
+bool del_timer(struct timer_list *timer)
+{
+	struct tvec_base *base = &tvec_bases[smp_processor_id()];
+	uint32_t flags = local_irq_save();
+
+	bool pending = timer_pending(timer);
+	if (pending)
+		detach_timer(base, timer);
+
+	local_irq_restore(flags);
+	return pending;
+}
+
+// NOTE: With the tick stopped jiffies can advance several steps at once, every skipped jiffy is
+// still processed so no cascade is missed
+static void run_timer_softirq()
+{
+	struct tvec_base *base = &tvec_bases[smp_processor_id()];
+
+	disable_interrupts();
+	while (time_after_eq(jiffies, base->timer_jiffies))
+	{
+		struct list_head work_list;
+		uint32_t index = base->timer_jiffies & TVR_MASK;
+
+		if (!index &&
+			!cascade(base, base->tv2, INDEX(0)) &&
+			!cascade(base, base->tv3, INDEX(1)) &&
+			!cascade(base, base->tv4, INDEX(2)))
+			cascade(base, base->tv5, INDEX(3));
+
+		base->timer_jiffies++;
+		list_replace_init(base->tv1 + index, &work_list);
+		base->tv1_bitmap[index / 32] &= ~(1u << (index % 32));
+
+		while (!list_empty(&work_list))
+		{
+			struct timer_list *timer = list_first_entry(&work_list, struct timer_list, entry);
+
+			detach_timer(base, timer);
+
+			// the callback may re-arm or delete any timer, including itself
+			enable_interrupts();
+			timer->function(timer);
+			disable_interrupts();
+		}
+	}
+	enable_interrupts();
+}
+
+// called from the tick, the actual work happens in TIMER_SOFTIRQ
+void run_local_timers()
+{
+	struct tvec_base *base = &tvec_bases[smp_processor_id()];
+
+	if (base->pending && time_after_eq(jiffies, base->timer_jiffies))
+		raise_softirq(TIMER_SOFTIRQ);
+}
+
+// NOTE: Called on every idle entry with interrupts off, so it must not walk timer lists.
+// Timers in tv2 and above expire at the next wrap of tv1 at the earliest, which is used as a
+// conservative bound. Before it only the tv1 slots from the current index on are looked at,
+// through the bitmap of non-empty slots
+static uint32_t timer_next_event_us()
+{
+	struct tvec_base *base = &tvec_bases[smp_processor_id()];
+
+	if (!base->pending)
+		return TICK_NO_EVENT;
+
+	uint32_t index = base->timer_jiffies & TVR_MASK;
+	uint32_t next = base->timer_jiffies + (TVR_SIZE - index);
+
+	for (uint32_t slot = index; slot < TVR_SIZE;)
+	{
+		uint32_t word = base->tv1_bitmap[slot / 32] & (~0u << (slot % 32));
+		if (!word)
+		{
+			slot = ALIGN_DOWN(slot, 32) + 32;
+			continue;
+		}
+
+		slot = ALIGN_DOWN(slot, 32) + __builtin_ctz(word);
+		if (!list_empty(base->tv1 + slot))
+		{
+			next = base->timer_jiffies + (slot - index);
+			break;
+		}
+		// every timer of the slot was deleted
+		base->tv1_bitmap[slot / 32] &= ~(1u << (slot % 32));
+	}
+
+	if (!time_after(next, jiffies))
+		return 0;
+	return (next - jiffies) * TICK_USEC;
+}
+
+void timer_init()
+{
+	serial_write("TIMER: Initializing\n");
+
+	for (uint32_t cpu = 0; cpu < NR_CPUS; ++cpu)
+	{
+		struct tvec_base *base = &tvec_bases[cpu];
+
+		for (uint32_t i = 0; i < TVR_SIZE; ++i)
+			INIT_LIST_HEAD(base->tv1 + i);
+		for (uint32_t i = 0; i < TVN_SIZE; ++i)
+		{
+			INIT_LIST_HEAD(base->tv2 + i);
+			INIT_LIST_HEAD(base->tv3 + i);
+			INIT_LIST_HEAD(base->tv4 + i);
+			INIT_LIST_HEAD(base->tv5 + i);
+		}
+		base->timer_jiffies = jiffies;
+	}
+
+	open_softirq(TIMER_SOFTIRQ, run_timer_softirq);
+	tick_register_next_event(timer_next_event_us);
+
+	serial_write("TIMER: Done\n");
+}
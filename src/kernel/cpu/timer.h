@@ -0,0 +1,42 @@
+#ifndef CPU_TIMER_H
+#define CPU_TIMER_H
+
+#include <include/list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+
+// jiffies wrap around, compare through the signed difference
+#define time_after(a, b) ((int32_t)((b) - (a)) < 0)
+#define time_after_eq(a, b) ((int32_t)((a) - (b)) >= 0)
+#define time_before(a, b) time_after(b, a)
+
+struct timer_list
+{
+	struct list_head entry;	 // next is NULL while the timer isn't pending
+	uint32_t expires;		 // in jiffies
+	void (*function)(struct timer_list *timer);
+};
+
+#define TIMER_INITIALIZER(_function, _expires) \
+	{.entry = {.next = NULL, .prev = NULL}, .expires = (_expires), .function = (_function)}
+
+void timer_init();
+void timer_setup(struct timer_list *timer, void (*function)(struct timer_list *timer));
+void add_timer(struct timer_list *timer);
+bool mod_timer(struct timer_list *timer, uint32_t expires);
+bool del_timer(struct timer_list *timer);
+void run_local_timers();
+
+static inline bool timer_pending(const struct timer_list *timer)
+{
+	return timer->entry.next != NULL;
+}
+
+#endif
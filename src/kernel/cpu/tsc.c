@@ -0,0 +1,92 @@
+#include "tsc.h"
+
+#include <devices/char/tty.h>
+#include <utils/debug.h>
+#include <utils/math.h>
+
+#include "clocksource.h"
+#include "hal.h"
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CH2_DATA 0x42
+#define PIT_REG_COMMAND 0x43
+#define PIT_CH2_GATE 0x61
+#define TSC_CALIBRATE_MS 50
+// the clocksource is folded on every tick, 10 minutes leaves plenty of headroom for a long idle
+#define TSC_MAXSEC 600
+
+uint32_t tsc_khz;
+
+static uint64_t tsc_read(struct clocksource *cs)
+{
+	return rdtsc();
+}
+
+static struct clocksource clocksource_tsc = {
+	.name = "tsc",
+	.rating = 300,
+	.mask = 0xffffffffffffffffULL,
+	.read = tsc_read,
+};
+
+// an invariant tsc runs at a constant rate in every P-, C- and T-state
+static bool tsc_is_invariant()
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & (1 << 4)))
+		return false;
+
+	cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+	if (eax < 0x80000007)
+		return false;
+
+	cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return edx & (1 << 8);
+}
+
+// NOTE: Channel 2 is used so the tick on channel 0 keeps running. Its gate is driven through port
+// 0x61 and the output can be polled there as well, no interrupt is involved
+static uint32_t tsc_calibrate_pit()
+{
+	uint32_t latch = PIT_FREQUENCY / (1000 / TSC_CALIBRATE_MS);
+	uint32_t flags = local_irq_save();
+
+	// gate high, speaker off
+	outportb(PIT_CH2_GATE, (inportb(PIT_CH2_GATE) & ~0x02) | 0x01);
+	// channel 2, lobyte/hibyte, mode 0
+	outportb(PIT_REG_COMMAND, 0xb0);
+	outportb(PIT_CH2_DATA, latch & 0xff);
+	outportb(PIT_CH2_DATA, (latch >> 8) & 0xff);
+
+	uint64_t start = rdtsc();
+	while (!(inportb(PIT_CH2_GATE) & 0x20))
+		;
+	uint64_t end = rdtsc();
+
+	local_irq_restore(flags);
+
+	return div_u64(end - start, TSC_CALIBRATE_MS);
+}
+
+void tsc_init()
+{
+	serial_write("TSC: Initializing\n");
+
+	if (!tsc_is_invariant())
+	{
+		serial_write("TSC: Not invariant, keeping the pit\n");
+		return;
+	}
+
+	tsc_khz = tsc_calibrate_pit();
+	serial_write("TSC: ");
+	serial_write_number(tsc_khz, 10);
+	serial_write(" kHz\n");
+
+	clocks_calc_mult_shift(&clocksource_tsc.mult, &clocksource_tsc.shift, tsc_khz, NSEC_PER_MSEC, TSC_MAXSEC);
+	clocksource_register(&clocksource_tsc);
+
+	serial_write("TSC: Done\n");
+}
@@ -0,0 +1,11 @@
+#ifndef CPU_TSC_H
+#define CPU_TSC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern uint32_t tsc_khz;
+
+void tsc_init();
+
+#endif
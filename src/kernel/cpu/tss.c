@@ -14,6 +14,12 @@ void tss_set_stack(uint32_t kernelSS, uint32_t kernelESP)
 	TSS.esp0 = kernelESP;
 }
 
+// the sysenter path loads its stack from here, so it always follows tss_set_stack
+uint32_t *tss_get_esp0()
+{
+	return &TSS.esp0;
+}
+
 void install_tss(uint32_t idx, uint32_t kernelSS, uint32_t kernelESP)
 {
     serial_write("TSS: Initializing\n");
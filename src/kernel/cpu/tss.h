@@ -34,4 +34,5 @@ struct __attribute__((packed)) tss_entry
 };
 
 void tss_set_stack(uint32_t kernelSS, uint32_t kernelESP);
+uint32_t *tss_get_esp0();
 void install_tss(uint32_t sel, uint32_t kernelSS, uint32_t kernelESP);
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "tty.h"
+
+#include <cpu/hal.h>
+#include <cpu/idt.h>
+#include <cpu/irq_stats.h>
+#include <cpu/softirq.h>
+#include <include/list.h>
+#include <memory/kmalloc_profile.h>
+#include <memory/mempool.h>
+#include <memory/vmm.h>
+#include <utils/debug.h>
+
+#define CONSOLE_LINE_SIZE 64
+#define CONSOLE_COMMANDS_RESERVED 4
+
+// NOTE: A tiny command line on the debug serial port to look at kernel statistics at runtime.
+// The irq handler only collects bytes, commands are queued from a mempool and run (and print) from a tasklet
+struct console_command
+{
+	struct list_head sibling;
+	char text[CONSOLE_LINE_SIZE];
+};
+
+static char line[CONSOLE_LINE_SIZE];
+static uint32_t line_length;
+static struct mempool *command_pool;
+static LIST_HEAD(command_queue);
+
+static bool console_match(const char *a, const char *b)
+{
+	while (*a && *a == *b)
+		a++, b++;
+	return *a == *b;
+}
+
+static void console_execute(const char *command)
+{
+	if (console_match(command, "irqstat"))
+		irq_stats_dump();
+	else if (console_match(command, "irqreset"))
+		irq_stats_reset();
+	else if (console_match(command, "kmalloc"))
+		kmalloc_profile_dump();
+	else if (command[0])
+		serial_write("commands: irqstat irqreset kmalloc\n");
+
+	serial_write("> ");
+}
+
+static void console_run(uint32_t data)
+{
+	while (true)
+	{
+		uint32_t flags = local_irq_save();
+		struct console_command *command = list_first_entry_or_null(&command_queue, struct console_command, sibling);
+		if (command)
+			list_del(&command->sibling);
+		local_irq_restore(flags);
+
+		if (!command)
+			break;
+
+		console_execute(command->text);
+		mempool_free(command, command_pool);
+	}
+}
+
+static DECLARE_TASKLET(console_tasklet, console_run, 0);
+
+static int32_t console_irq_handler(struct interrupt_registers *regs)
+{
+	while (serial_received(cur_port))
+	{
+		char c = serial_read(cur_port);
+
+		if (c == '\r' || c == '\n')
+		{
+			serial_write("\n");
+			// the reserve covers a few lines typed while commands are still running, beyond that they are dropped
+			struct console_command *command = mempool_alloc(command_pool, GFP_ATOMIC);
+			if (command)
+			{
+				for (uint32_t i = 0; i <= line_length; ++i)
+					command->text[i] = line[i];
+				list_add_tail(&command->sibling, &command_queue);
+				tasklet_schedule(&console_tasklet);
+			}
+			else
+				serial_write("CONSOLE: Line dropped\n");
+			line_length = 0;
+			line[0] = '\0';
+		}
+		else if ((c == '\b' || c == 0x7f) && line_length > 0)
+		{
+			line[--line_length] = '\0';
+			serial_write("\b \b");
+		}
+		else if (c >= ' ' && c < 0x7f && line_length < CONSOLE_LINE_SIZE - 1)
+		{
+			line[line_length++] = c;
+			line[line_length] = '\0';
+			serial_output(cur_port, c);
+		}
+	}
+
+	irq_ack(regs->int_no);
+	return IRQ_HANDLER_CONTINUE;
+}
+
+void serial_console_init()
+{
+	serial_write("CONSOLE: Initializing\n");
+
+	struct kmem_cache *cache = kmem_cache_create("console_command", sizeof(struct console_command), 0, NULL);
+	command_pool = cache ? mempool_create_slab_pool(CONSOLE_COMMANDS_RESERVED, cache) : NULL;
+	if (!command_pool)
+	{
+		serial_write("CONSOLE: No command pool\n");
+		return;
+	}
+
+	register_interrupt_handler(IRQ4, console_irq_handler);
+	serial_enable_rx_interrupt(cur_port);
+	irq_clear_mask(4);
+
+	serial_write("CONSOLE: Done\n");
+}
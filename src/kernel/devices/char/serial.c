@@ -19,6 +19,24 @@ int serial_write(const char *buf)
     }
 }
 
+// base 10 or 16 (hex is printed with a 0x prefix)
+void serial_write_number(uint32_t value, uint32_t base)
+{
+	char buf[11];
+	int i = sizeof(buf) - 1;
+
+	buf[i] = '\0';
+	do
+	{
+		buf[--i] = "0123456789abcdef"[value % base];
+		value /= base;
+	} while (value);
+
+	if (base == 16)
+		serial_write("0x");
+	serial_write(&buf[i]);
+}
+
 void serial_enable(int port)
 {
     outportb(port + 1, 0x00);
@@ -32,6 +50,22 @@ void serial_enable(int port)
     cur_port = port;
 }
 
+// raise irq4 (com1) / irq3 (com2) whenever a byte arrives, OUT2 is already set by serial_enable
+void serial_enable_rx_interrupt(int port)
+{
+	outportb(port + 1, 0x01);
+}
+
+int serial_received(int port)
+{
+	return inportb(port + 5) & 0x01;
+}
+
+char serial_read(int port)
+{
+	return inportb(port);
+}
+
 int serial_transmit_empty(int port)
 {
 	return inportb(port + 5) & 0x20;
@@ -1,4 +1,17 @@
 #pragma once
 
+#include <stdint.h>
+
 void serial_enable(int port);
-int serial_write(const char *buf);
\ No newline at end of file
+void serial_output(int port, char a);
+// NOTE: utils/debug.h only uses serial_write through its macros and does not declare it,
+// so every caller of the serial helpers includes this header
+int serial_write(const char *buf);
+void serial_write_number(uint32_t value, uint32_t base);
+void serial_enable_rx_interrupt(int port);
+int serial_received(int port);
+char serial_read(int port);
+
+extern int cur_port;
+
+void serial_console_init();
\ No newline at end of file
@@ -7,6 +7,12 @@
 // MQ 2019-08-08
 // Explain how list_head works https://kernelnewbies.org/FAQ/LinkedLists
 
+#ifndef container_of
+#define container_of(ptr, type, member) ({                \
+	const typeof(((type *)0)->member) *__mptr = (ptr); \
+	(type *)((char *)__mptr - offsetof(type, member)); })
+#endif
+
 #define LIST_POISON1 NULL
 #define LIST_POISON2 NULL
 
@@ -0,0 +1,58 @@
+#ifndef INCLUDE_SEQLOCK_H
+#define INCLUDE_SEQLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+  Sequence counter for data which is read often and written rarely
+  The writer makes the counter odd while it updates and even again once it is done, a reader copies
+  the data and retries if the counter was odd or moved in the meantime. Readers never block the
+  writer and never write shared memory themselves.
+  NOTE: There must only be one writer at a time and it must not be interrupted by a reader on the
+  same cpu, otherwise that reader spins forever on the odd counter. Write with interrupts disabled
+*/
+typedef struct
+{
+	volatile uint32_t sequence;
+} seqcount_t;
+
+#define SEQCNT_ZERO \
+	{               \
+		0           \
+	}
+
+#ifndef barrier
+#define barrier() asm volatile("" ::: "memory")
+#endif
+
+static inline uint32_t read_seqcount_begin(const seqcount_t *s)
+{
+	uint32_t seq;
+
+	while ((seq = s->sequence) & 1)
+		asm volatile("pause");
+	barrier();
+	return seq;
+}
+
+static inline bool read_seqcount_retry(const seqcount_t *s, uint32_t start)
+{
+	barrier();
+	return s->sequence != start;
+}
+
+// NOTE: x86 does not reorder stores with other stores, so keeping the compiler in order is enough
+static inline void write_seqcount_begin(seqcount_t *s)
+{
+	s->sequence++;
+	barrier();
+}
+
+static inline void write_seqcount_end(seqcount_t *s)
+{
+	barrier();
+	s->sequence++;
+}
+
+#endif
@@ -9,10 +9,22 @@
 #include "cpu/idt.h"
 #include "memory/pmm.h"
 #include "memory/vmm.h"
+#include "memory/rmap.h"
 #include "cpu/exceptions.h"
+#include "cpu/hpet.h"
+#include "cpu/fpu.h"
+#include "cpu/apic.h"
 #include "cpu/pit.h"
 #include "cpu/rtc.h"
+#include "cpu/softirq.h"
+#include "cpu/clocksource.h"
+#include "cpu/syscall.h"
+#include "cpu/tsc.h"
+#include "cpu/tick.h"
+#include "cpu/timer.h"
+#include "system/acpi.h"
 #include "system/framebuffer.h"
+#include "devices/char/tty.h"
 
 int kernel_main(uint32_t addr, uint32_t magic)
 {
@@ -22,6 +34,7 @@ int kernel_main(uint32_t addr, uint32_t magic)
     struct multiboot_tage_basic_meminfo *multiboot_meminfo;
     struct multiboot_tag_mmap *multiboot_mmap;
 	struct multiboot_tag_framebuffer *multiboot_framebuffer;
+	struct multiboot_tag *multiboot_acpi = NULL;
 
 	struct multiboot_tag *tag;
 	for (tag = (struct multiboot_tag *)(addr + 8);
@@ -38,6 +51,14 @@ int kernel_main(uint32_t addr, uint32_t magic)
 			multiboot_mmap = (struct multiboot_tag_mmap *)tag;
 			break;
 		}
+		case MULTIBOOT_TAG_TYPE_ACPI_OLD:
+		case MULTIBOOT_TAG_TYPE_ACPI_NEW:
+		{
+			// prefer the acpi 2.0 rsdp when both are given
+			if (!multiboot_acpi || tag->type == MULTIBOOT_TAG_TYPE_ACPI_NEW)
+				multiboot_acpi = tag;
+			break;
+		}
 		case MULTIBOOT_TAG_TYPE_FRAMEBUFFER:
 		{
 			multiboot_framebuffer = (struct multiboot_tag_framebuffer *)tag;
@@ -55,20 +76,32 @@ int kernel_main(uint32_t addr, uint32_t magic)
 
 	pmm_init(multiboot_meminfo, multiboot_mmap);
 	vmm_init();
+	rmap_init();
+	vmalloc_init();
+	kmalloc_init();
+	tss_set_stack(0x10, (uint32_t)create_kernel_stack(KERNEL_STACK_BLOCKS));
 
 	exception_init();
+	softirq_init();
+	timer_init();
+	fpu_init();
+	syscall_init();
 
-	rtc_init();
+	acpi_init(multiboot_acpi);
+	apic_init();
+
+	clocksource_init();
 	pit_init();
+	hpet_init();
+	tsc_init();
+	rtc_init();
 
 	framebuffer_init(multiboot_framebuffer);
+	serial_console_init();
 
 	asm volatile("sti");
 
-	
-
-    for (;;)
-        ;
+	cpu_idle();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include "kmalloc_profile.h"
+
+#include <cpu/timer.h>
+#include <devices/char/tty.h>
+#include <utils/math.h>
+#include <utils/string.h>
+
+#include "vmm.h"
+
+extern volatile uint32_t jiffies;
+
+static struct kmalloc_site sites[KMALLOC_PROFILE_SITES];
+static uint32_t size_histogram[KMALLOC_PROFILE_CLASSES];
+static uint32_t dropped_allocs = 0;	 // call sites which didn't fit into the table
+static uint32_t profile_start = 0;
+
+static struct kmalloc_site *kmalloc_profile_site(uint32_t caller, bool create)
+{
+	uint32_t index = (caller * 2654435761u) >> 24;
+
+	for (uint32_t i = 0; i < KMALLOC_PROFILE_SITES; ++i)
+	{
+		struct kmalloc_site *site = &sites[(index + i) % KMALLOC_PROFILE_SITES];
+		if (site->caller == caller)
+			return site;
+		if (!site->caller)
+		{
+			if (!create)
+				return NULL;
+			site->caller = caller;
+			return site;
+		}
+	}
+	return NULL;
+}
+
+void kmalloc_profile_alloc(uint32_t caller, size_t size, uint8_t size_class)
+{
+	size_histogram[min_t(uint32_t, size_class, KMALLOC_PROFILE_CLASSES - 1)]++;
+
+	struct kmalloc_site *site = kmalloc_profile_site(caller, true);
+	if (!site)
+	{
+		dropped_allocs++;
+		return;
+	}
+
+	site->allocs++;
+	site->live_count++;
+	site->live_bytes += size;
+}
+
+void kmalloc_profile_free(uint32_t caller, size_t size)
+{
+	struct kmalloc_site *site = kmalloc_profile_site(caller, false);
+	if (!site)
+		return;
+
+	site->frees++;
+	site->live_count--;
+	site->live_bytes -= size;
+}
+
+// counters only, live blocks stay attributed to their call sites
+void kmalloc_profile_reset()
+{
+	for (int i = 0; i < KMALLOC_PROFILE_SITES; ++i)
+		sites[i].allocs = sites[i].frees = 0;
+	memset(size_histogram, 0, sizeof(size_histogram));
+	dropped_allocs = 0;
+	profile_start = jiffies;
+}
+
+#ifdef CONFIG_KMALLOC_PROFILE
+static void kmalloc_profile_visit(uint32_t caller, uint32_t timestamp, size_t size)
+{
+	struct kmalloc_site *site = kmalloc_profile_site(caller, false);
+	if (site && (!site->oldest_valid || time_before(timestamp, site->oldest)))
+	{
+		site->oldest = timestamp;
+		site->oldest_valid = true;
+	}
+}
+#endif
+
+static void kmalloc_profile_write_field(const char *name, uint32_t value, uint32_t base)
+{
+	serial_write(name);
+	serial_write_number(value, base);
+}
+
+void kmalloc_profile_dump()
+{
+	struct kmalloc_stats stats;
+	kmalloc_get_stats(&stats);
+
+	uint32_t now = jiffies;
+	uint32_t elapsed_seconds = max_t(uint32_t, (now - profile_start) / 1000, 1);
+
+	serial_write("KMALLOC: heap");
+	kmalloc_profile_write_field(" size=", stats.heap_size, 10);
+	kmalloc_profile_write_field(" used=", stats.used_bytes, 10);
+	kmalloc_profile_write_field("/", stats.used_blocks, 10);
+	kmalloc_profile_write_field(" free=", stats.free_bytes, 10);
+	kmalloc_profile_write_field("/", stats.free_blocks, 10);
+	kmalloc_profile_write_field(" largest_free=", stats.largest_free, 10);
+	kmalloc_profile_write_field(" cached=", stats.cached_bytes, 10);
+	kmalloc_profile_write_field("/", stats.cached_blocks, 10);
+	// free/used ratio in percent, a high ratio with a small largest_free means fragmentation
+	kmalloc_profile_write_field(" free_ratio=", stats.used_bytes ? stats.free_bytes * 100 / stats.used_bytes : 0, 10);
+	serial_write("%\n");
+
+	serial_write("KMALLOC: size histogram (log2 bytes: count)\n");
+	for (int i = 0; i < KMALLOC_PROFILE_CLASSES; ++i)
+		if (size_histogram[i])
+		{
+			kmalloc_profile_write_field("  ", i, 10);
+			kmalloc_profile_write_field(": ", size_histogram[i], 10);
+			serial_write("\n");
+		}
+
+#ifdef CONFIG_KMALLOC_PROFILE
+	for (int i = 0; i < KMALLOC_PROFILE_SITES; ++i)
+		sites[i].oldest_valid = false;
+	kmalloc_for_each_allocated(kmalloc_profile_visit);
+#endif
+
+	serial_write("KMALLOC: call sites (caller live_bytes live_count allocs/s oldest_ms)\n");
+	for (int i = 0; i < KMALLOC_PROFILE_SITES; ++i)
+	{
+		struct kmalloc_site *site = &sites[i];
+		if (!site->caller || (!site->live_count && !site->allocs))
+			continue;
+
+		kmalloc_profile_write_field("  ", site->caller, 16);
+		kmalloc_profile_write_field(" ", site->live_bytes, 10);
+		kmalloc_profile_write_field(" ", site->live_count, 10);
+		kmalloc_profile_write_field(" ", site->allocs / elapsed_seconds, 10);
+		kmalloc_profile_write_field(" ", site->oldest_valid ? now - site->oldest : 0, 10);
+		serial_write("\n");
+	}
+
+	if (dropped_allocs)
+	{
+		kmalloc_profile_write_field("KMALLOC: allocations from untracked call sites ", dropped_allocs, 10);
+		serial_write("\n");
+	}
+	serial_write("KMALLOC: Done\n");
+}
@@ -0,0 +1,33 @@
+#ifndef MEMORY_KMALLOC_PROFILE_H
+#define MEMORY_KMALLOC_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// NOTE: Build with -DCONFIG_KMALLOC_PROFILE to record the caller, a timestamp and the size class
+// of every kmalloc'ed block. Without it none of this is compiled in and block_meta keeps its size
+#define KMALLOC_PROFILE_SITES 256
+#define KMALLOC_PROFILE_CLASSES 26
+
+struct kmalloc_site
+{
+	uint32_t caller;
+	uint32_t live_bytes;
+	uint32_t live_count;
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t oldest;  // jiffies of the oldest live block, only valid while dumping
+	bool oldest_valid;
+};
+
+void kmalloc_profile_alloc(uint32_t caller, size_t size, uint8_t size_class);
+void kmalloc_profile_free(uint32_t caller, size_t size);
+void kmalloc_profile_reset();
+void kmalloc_profile_dump();
+
+#ifdef CONFIG_KMALLOC_PROFILE
+void kmalloc_for_each_allocated(void (*fn)(uint32_t caller, uint32_t timestamp, size_t size));
+#endif
+
+#endif
@@ -0,0 +1,136 @@
+#include <cpu/hal.h>
+#include <cpu/smp.h>
+#include <utils/debug.h>
+
+#include "vmm.h"
+
+#define KERNEL_STACK_SLOT_PAGES (KERNEL_STACK_MAX_BLOCKS + 1)
+#define KERNEL_STACK_SLOT_SIZE (KERNEL_STACK_SLOT_PAGES * PMM_FRAME_SIZE)
+#define KERNEL_STACK_SLOTS ((KERNEL_STACK_TOP - KERNEL_STACK_BOTTOM) / KERNEL_STACK_SLOT_SIZE)
+#define KERNEL_STACK_CACHE_SIZE 8
+
+/*
+  Each stack owns a fixed slot in the kernel stack window, the stack sits at the top of its slot
+  and at least one page below it is never mapped. Overflowing the stack faults on that guard page
+  instead of running into whatever is below
+  +-------------------------+ slot + KERNEL_STACK_SLOT_SIZE (returned stack top)
+  | stack (blocks pages)    |
+  |-------------------------|
+  | guard (unmapped)        |
+  +-------------------------+ slot
+*/
+struct kernel_stack_cache
+{
+	uint32_t nr;
+	uint32_t tops[KERNEL_STACK_CACHE_SIZE];
+};
+
+static uint32_t kernel_stack_slots[KERNEL_STACK_SLOTS / 32];
+static uint8_t kernel_stack_blocks[KERNEL_STACK_SLOTS];
+static struct kernel_stack_cache kernel_stack_caches[NR_CPUS];
+
+static int32_t kernel_stack_alloc_slot()
+{
+	for (uint32_t i = 0; i < KERNEL_STACK_SLOTS / 32; ++i)
+		if (kernel_stack_slots[i] != 0xffffffff)
+		{
+			uint32_t bit = __builtin_ctz(~kernel_stack_slots[i]);
+			kernel_stack_slots[i] |= 1u << bit;
+			return i * 32 + bit;
+		}
+	return -1;
+}
+
+static void kernel_stack_free_slot(uint32_t slot)
+{
+	kernel_stack_slots[slot / 32] &= ~(1u << (slot % 32));
+}
+
+static uint32_t kernel_stack_top(uint32_t slot)
+{
+	return KERNEL_STACK_BOTTOM + (slot + 1) * KERNEL_STACK_SLOT_SIZE;
+}
+
+static uint32_t kernel_stack_slot(uint32_t top)
+{
+	return (top - KERNEL_STACK_BOTTOM) / KERNEL_STACK_SLOT_SIZE - 1;
+}
+
+// stacks of exited threads are kept mapped in a per-cpu cache, so creating a thread usually
+// costs a pop instead of allocating and mapping pages
+static void *kernel_stack_cache_get(int32_t blocks)
+{
+	struct kernel_stack_cache *cache = &kernel_stack_caches[smp_processor_id()];
+	void *stack = NULL;
+
+	uint32_t flags = local_irq_save();
+	for (uint32_t i = cache->nr; i-- > 0;)
+		if (kernel_stack_blocks[kernel_stack_slot(cache->tops[i])] == blocks)
+		{
+			stack = (void *)cache->tops[i];
+			cache->tops[i] = cache->tops[--cache->nr];
+			break;
+		}
+	local_irq_restore(flags);
+
+	return stack;
+}
+
+static bool kernel_stack_cache_put(void *stack)
+{
+	struct kernel_stack_cache *cache = &kernel_stack_caches[smp_processor_id()];
+	bool cached = false;
+
+	uint32_t flags = local_irq_save();
+	if (cache->nr < KERNEL_STACK_CACHE_SIZE)
+	{
+		cache->tops[cache->nr++] = (uint32_t)stack;
+		cached = true;
+	}
+	local_irq_restore(flags);
+
+	return cached;
+}
+
+// return the top of the new stack (initial esp)
+void *create_kernel_stack(int32_t blocks)
+{
+	if (blocks <= 0 || blocks > KERNEL_STACK_MAX_BLOCKS)
+		return NULL;
+
+	void *stack = kernel_stack_cache_get(blocks);
+	if (stack)
+		return stack;
+
+	int32_t slot = kernel_stack_alloc_slot();
+	if (slot < 0)
+		return NULL;
+
+	uint32_t top = kernel_stack_top(slot);
+	for (uint32_t vaddr = top - blocks * PMM_FRAME_SIZE; vaddr < top; vaddr += PMM_FRAME_SIZE)
+	{
+		uint32_t paddr = (uint32_t)pmm_alloc_block();
+		if (!paddr)
+		{
+			vmm_free_range(top - blocks * PMM_FRAME_SIZE, vaddr);
+			kernel_stack_free_slot(slot);
+			return NULL;
+		}
+		vmm_map_address(vmm_get_directory(), vaddr, paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE);
+	}
+
+	kernel_stack_blocks[slot] = blocks;
+	return (void *)top;
+}
+
+void free_kernel_stack(void *stack)
+{
+	if (!stack || kernel_stack_cache_put(stack))
+		return;
+
+	uint32_t top = (uint32_t)stack;
+	uint32_t slot = kernel_stack_slot(top);
+
+	vmm_free_range(top - kernel_stack_blocks[slot] * PMM_FRAME_SIZE, top);
+	kernel_stack_free_slot(slot);
+}
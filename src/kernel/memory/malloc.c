@@ -1,24 +1,95 @@
+#include <cpu/hal.h>
+#include <cpu/smp.h>
+#include <cpu/softirq.h>
 #include <include/errno.h>
 #include <stdbool.h>
 #include <utils/debug.h>
 #include <utils/math.h>
 #include <utils/string.h>
 
+#include "kmalloc_profile.h"
+#include "slab.h"
 #include "vmm.h"
 
 #define BLOCK_MAGIC 0x464E
+#define BLOCK_MIN_SIZE sizeof(struct free_links)
+// [8, 16), [16, 32) ... [2048, 4096) are small classes, everything else lives in the large class
+#define KMALLOC_MIN_SHIFT 3
+#define KMALLOC_LARGE_SHIFT 12
+#define KMALLOC_LARGE_CLASS (KMALLOC_LARGE_SHIFT - KMALLOC_MIN_SHIFT)
+#define KMALLOC_CLASSES (KMALLOC_LARGE_CLASS + 1)
+// free blocks from this size on give their pages back to the pmm, the top of the heap keeps a pad
+#define KMALLOC_TRIM_THRESHOLD 0x20000
+#define KMALLOC_TOP_PAD 0x10000
+// objects of [2^k, 2^(k+1)) are cached in magazine class k and serve requests of (2^(k-1), 2^k]
+#define MAGAZINE_MAX_SHIFT 11
+#define MAGAZINE_CLASSES (MAGAZINE_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define MAGAZINE_SIZE 16
+#define DEPOT_MAX_FULL 8
+#define DEPOT_RESERVE_EMPTY 2
+// large free blocks a GFP_ATOMIC allocation looks at before it gives up
+#define KMALLOC_ATOMIC_SCAN 8
 
 extern uint32_t heap_current;
 
+// NOTE: Blocks are laid out back to back from KERNEL_HEAP_BOTTOM to sbrk(0)
+// | block_meta | payload (size) | block_footer | block_meta | ...
+// the footer (boundary tag) lets kfree find the previous block in O(1)
 struct block_meta
 {
 	size_t size;
-	struct block_meta *next;
 	bool free;
+	bool trimmed;  // some pages inside the payload are unmapped, only ever set on free blocks
+	bool cached;   // parked in a magazine, in use for the heap but not for any caller
+#ifdef CONFIG_KMALLOC_PROFILE
+	uint8_t size_class;
+	uint32_t caller;
+	uint32_t timestamp;	 // jiffies
+#endif
 	uint32_t magic;
 };
 
+struct block_footer
+{
+	size_t size;
+	bool free;
+};
+
+// NOTE: Free blocks keep their size class links in the payload, so a block costs nothing extra while in use
+struct free_links
+{
+	struct block_meta *next;
+	struct block_meta *prev;
+};
+
 static struct block_meta *kblocklist = NULL;
+static struct block_meta *kblocklast = NULL;
+static struct block_meta *kfreelists[KMALLOC_CLASSES];
+static uint32_t kfreelists_bitmap = 0;
+
+struct magazine
+{
+	uint32_t rounds;
+	struct magazine *next;
+	void *objs[MAGAZINE_SIZE];
+};
+
+struct magazine_cpu_cache
+{
+	struct magazine *loaded;
+	struct magazine *previous;
+};
+
+struct magazine_depot
+{
+	struct magazine *full;
+	struct magazine *empty;
+	uint32_t nr_full;
+};
+
+static struct kmem_cache *magazine_cache;
+static struct magazine_cpu_cache magazine_cpu_caches[NR_CPUS][MAGAZINE_CLASSES];
+static struct magazine_depot magazine_depots[MAGAZINE_CLASSES];
 
 void assert_kblock_valid(struct block_meta *block)
 {
@@ -27,105 +98,463 @@ void assert_kblock_valid(struct block_meta *block)
 		assert_not_reached();
 }
 
-struct block_meta *find_free_block(struct block_meta **last, size_t size)
+static struct block_footer *get_block_footer(struct block_meta *block)
+{
+	return (struct block_footer *)((char *)(block + 1) + block->size);
+}
+
+static void set_block(struct block_meta *block, size_t size, bool free)
+{
+	block->size = size;
+	block->free = free;
+	block->magic = BLOCK_MAGIC;
+
+	struct block_footer *footer = get_block_footer(block);
+	footer->size = size;
+	footer->free = free;
+}
+
+static void set_block_free(struct block_meta *block, bool free)
+{
+	block->free = free;
+	get_block_footer(block)->free = free;
+}
+
+static struct block_meta *get_next_block(struct block_meta *block)
+{
+	if (block == kblocklast)
+		return NULL;
+	return (struct block_meta *)(get_block_footer(block) + 1);
+}
+
+static struct block_meta *get_prev_block(struct block_meta *block)
+{
+	if (block == kblocklist)
+		return NULL;
+
+	struct block_footer *footer = (struct block_footer *)block - 1;
+	return (struct block_meta *)((char *)footer - footer->size) - 1;
+}
+
+struct block_meta *get_block_ptr(void *ptr)
+{
+	return (struct block_meta *)ptr - 1;
+}
+
+static struct free_links *get_free_links(struct block_meta *block)
+{
+	return (struct free_links *)(block + 1);
+}
+
+static uint32_t get_size_class(size_t size)
+{
+	if (size >= (1 << KMALLOC_LARGE_SHIFT))
+		return KMALLOC_LARGE_CLASS;
+	return log2(size) - KMALLOC_MIN_SHIFT;
+}
+
+static void freelist_insert(struct block_meta *block)
+{
+	uint32_t class = get_size_class(block->size);
+	struct free_links *links = get_free_links(block);
+
+	links->prev = NULL;
+	links->next = kfreelists[class];
+	if (kfreelists[class])
+		get_free_links(kfreelists[class])->prev = block;
+	kfreelists[class] = block;
+	kfreelists_bitmap |= 1 << class;
+}
+
+static void freelist_remove(struct block_meta *block)
+{
+	uint32_t class = get_size_class(block->size);
+	struct free_links *links = get_free_links(block);
+
+	if (links->prev)
+		get_free_links(links->prev)->next = links->next;
+	else
+		kfreelists[class] = links->next;
+	if (links->next)
+		get_free_links(links->next)->prev = links->prev;
+
+	if (!kfreelists[class])
+		kfreelists_bitmap &= ~(1 << class);
+}
+
+// NOTE: Every block in class k+1 and above is >= 2^(k+1), so taking the head of the first non-empty class
+// above the requested size's class always fits. Only the large class needs a (first-fit) walk,
+// which GFP_ATOMIC cuts short so it stays bounded
+struct block_meta *find_free_block(size_t size, uint32_t flags)
+{
+	uint32_t class = get_size_class(size);
+	struct block_meta *head = kfreelists[class];
+
+	if (head && head->size >= size)
+		return head;
+
+	if (class < KMALLOC_LARGE_CLASS)
+	{
+		uint32_t larger = kfreelists_bitmap & ~((1 << (class + 1)) - 1);
+		if (!larger)
+			return NULL;
+
+		class = __builtin_ctz(larger);
+		if (class < KMALLOC_LARGE_CLASS)
+			return kfreelists[class];
+	}
+
+	uint32_t scan = (flags & GFP_ATOMIC) ? KMALLOC_ATOMIC_SCAN : UINT32_MAX;
+	for (struct block_meta *block = kfreelists[KMALLOC_LARGE_CLASS]; block && scan; block = get_free_links(block)->next, scan--)
+	{
+		assert_kblock_valid(block);
+		if (block->size >= size)
+			return block;
+	}
+	return NULL;
+}
+
+// merge a free block (which is not in any free list yet) with its free neighbours
+static struct block_meta *coalesce_block(struct block_meta *block)
 {
-	struct block_meta *current = (struct block_meta *)kblocklist;
-	while (current && !(current->free && current->size >= size))
+	struct block_meta *next = get_next_block(block);
+	if (next && next->free)
 	{
-		assert_kblock_valid(current);
-		*last = current;
-		current = current->next;
-		if (current)
-			assert_kblock_valid(current);
+		freelist_remove(next);
+		if (next == kblocklast)
+			kblocklast = block;
+		set_block(block, block->size + sizeof(struct block_footer) + sizeof(struct block_meta) + next->size, true);
+		block->trimmed |= next->trimmed;
 	}
-	return current;
+
+	struct block_meta *prev = get_prev_block(block);
+	if (prev && prev->free)
+	{
+		freelist_remove(prev);
+		if (block == kblocklast)
+			kblocklast = prev;
+		set_block(prev, prev->size + sizeof(struct block_footer) + sizeof(struct block_meta) + block->size, true);
+		prev->trimmed |= block->trimmed;
+		block = prev;
+	}
+
+	return block;
 }
 
 void split_block(struct block_meta *block, size_t size)
 {
-	if (block->size > size + sizeof(struct block_meta))
+	if (block->size >= size + sizeof(struct block_footer) + sizeof(struct block_meta) + BLOCK_MIN_SIZE)
 	{
-		struct block_meta *splited_block = (struct block_meta *)((char *)block + sizeof(struct block_meta) + size);
-		splited_block->free = true;
-		splited_block->magic = BLOCK_MAGIC;
-		splited_block->size = block->size - size - sizeof(struct block_meta);
-		splited_block->next = block->next;
+		size_t remaining_size = block->size - size - sizeof(struct block_footer) - sizeof(struct block_meta);
+
+		set_block(block, size, block->free);
+		struct block_meta *splited_block = (struct block_meta *)(get_block_footer(block) + 1);
+		set_block(splited_block, remaining_size, true);
+		splited_block->trimmed = block->trimmed;
+		if (kblocklast == block)
+			kblocklast = splited_block;
 
-		block->size = size;
-		block->next = splited_block;
+		freelist_insert(coalesce_block(splited_block));
 	}
 }
 
-struct block_meta *request_space(struct block_meta *last, size_t size)
+struct block_meta *request_space(size_t size)
 {
-	struct block_meta *block = sbrk(size + sizeof(struct block_meta));
+	struct block_meta *block = sbrk(sizeof(struct block_meta) + size + sizeof(struct block_footer));
+	if (!block)
+		return NULL;
 
-	if (last)
-		last->next = block;
+	if (!kblocklist)
+		kblocklist = block;
+	kblocklast = block;
 
-	block->size = size;
-	block->next = NULL;
-	block->free = false;
-	block->magic = BLOCK_MAGIC;
+	set_block(block, size, false);
+	block->trimmed = false;
 	return block;
 }
 
-void *kmalloc(size_t size)
+// everything an allocation of `size` from `block` and the header of a split off remainder will touch
+static uint32_t block_used_end(struct block_meta *block, size_t size)
 {
-	if (size <= 0)
-		return NULL;
+	return (uint32_t)(block + 1) + size + sizeof(struct block_footer) + sizeof(struct block_meta) + BLOCK_MIN_SIZE;
+}
 
-	struct block_meta *block;
+// NOTE: Before a trimmed block is (partly) handed out, back everything it will touch.
+// The remainder stays trimmed. Fails when there are no frames left to back it
+static bool populate_block(struct block_meta *block, size_t size)
+{
+	if (!block->trimmed)
+		return true;
 
-	size = ALIGN_UP(size, 4);
+	uint32_t block_end = (uint32_t)(get_block_footer(block) + 1);
+	return sbrk_populate_pages((uint32_t)block, min(block_end, block_used_end(block, size)));
+}
 
-	if (kblocklist)
+static void trim_block(struct block_meta *block)
+{
+	if (block->size < KMALLOC_TRIM_THRESHOLD)
+		return;
+
+	if (block == kblocklast)
 	{
-		struct block_meta *last = kblocklist;
-		block = find_free_block(&last, size);
-		if (block)
-		{
-			block->free = false;
-			split_block(block, size);
-		}
-		else
-			block = request_space(last, size);
+		size_t excess = block->size - KMALLOC_TOP_PAD;
+		struct block_footer *footer = (struct block_footer *)((char *)(block + 1) + KMALLOC_TOP_PAD);
+
+		if (!sbrk_populate_pages((uint32_t)footer, (uint32_t)(footer + 1)))
+			return;
+		set_block(block, KMALLOC_TOP_PAD, true);
+		sbrk_trim(excess);
+		return;
 	}
-	else
+
+	uint32_t start = PAGE_ALIGN((uint32_t)(get_free_links(block) + 1));
+	uint32_t end = ALIGN_DOWN((uint32_t)get_block_footer(block), PMM_FRAME_SIZE);
+	if (start < end)
 	{
-		block = request_space(NULL, size);
-		kblocklist = block;
+		vmm_free_range(start, end);
+		block->trimmed = true;
 	}
+}
 
-	assert_kblock_valid(block);
+// grow the free block at the top of the heap instead of leaving it behind as a hole
+static struct block_meta *extend_last_block(size_t size)
+{
+	struct block_meta *block = kblocklast;
+
+	if (!sbrk(size - block->size))
+		return NULL;
+
+	freelist_remove(block);
+	set_block(block, size, false);
+	if (!populate_block(block, size))
+	{
+		// keep the grown block, it is still free and ends at the heap top
+		set_block(block, size, true);
+		freelist_insert(block);
+		return NULL;
+	}
+	block->trimmed = false;
+	return block;
+}
+
+// NOTE: GFP_ATOMIC only takes memory which is already mapped, it never grows the heap or backs trimmed
+// pages, so it doesn't touch page tables or the pmm and is bounded; it fails instead
+static void *__heap_alloc(size_t size, uint32_t flags)
+{
+	struct block_meta *block = find_free_block(size, flags);
+	if ((flags & GFP_ATOMIC) && (!block || block->trimmed))
+		return NULL;
 
 	if (block)
-		return block + 1;
+	{
+		assert_kblock_valid(block);
+		if (!populate_block(block, size))
+			return NULL;
+		freelist_remove(block);
+		set_block_free(block, false);
+		split_block(block, size);
+		block->trimmed = false;
+	}
+	else if (kblocklast && kblocklast->free)
+		block = extend_last_block(size);
 	else
+		block = request_space(size);
+
+	if (!block)
 		return NULL;
+
+	assert_kblock_valid(block);
+	block->cached = false;
+	return block + 1;
 }
 
-void *kcalloc(size_t n, size_t size)
+// NOTE: Trimming unmaps pages and hands frames to the pmm, it is skipped in interrupt context
+// and when draining magazines; the block is simply trimmed the next time it is freed
+static void __heap_free(void *ptr, bool trim)
 {
-	void *block = kmalloc(n * size);
-	if (block)
-		memset(block, 0, n * size);
-	return block;
+	struct block_meta *block = get_block_ptr(ptr);
+
+	set_block_free(block, true);
+	block = coalesce_block(block);
+	if (trim)
+		trim_block(block);
+	freelist_insert(block);
 }
 
-struct block_meta *get_block_ptr(void *ptr)
+// NOTE: GFP_ATOMIC allocations come from interrupt context, so the block list and the free lists
+// are only ever changed with interrupts off
+static void *heap_alloc(size_t size, uint32_t flags)
 {
-	return (struct block_meta *)ptr - 1;
+	uint32_t irq_flags = local_irq_save();
+	void *ptr = __heap_alloc(size, flags);
+	local_irq_restore(irq_flags);
+	return ptr;
 }
 
-void kfree(void *ptr)
+static void heap_free(void *ptr, bool trim)
+{
+	uint32_t flags = local_irq_save();
+	__heap_free(ptr, trim);
+	local_irq_restore(flags);
+}
+
+// NOTE: Magazine layer (Bonwick & Adams, "Magazines and Vmem")
+// Each cpu holds a loaded and a previous magazine per class, so an alloc/free pair is a stack pop/push
+// on cpu local data with interrupts off. Only when both are exhausted a full/empty magazine is
+// exchanged with the depot. The depot is only touched with interrupts off too, which is enough
+// as long as NR_CPUS is 1; it is the one place which needs a lock once more cpus come up.
+// Empty magazines come from a reserve filled at boot and atomic slab allocations, so a kfree never
+// grows the slab; without an empty magazine the object just goes back to the heap
+static struct magazine *depot_get_full(struct magazine_depot *depot)
+{
+	struct magazine *mag = depot->full;
+	if (mag)
+	{
+		depot->full = mag->next;
+		depot->nr_full--;
+	}
+	return mag;
+}
+
+static void depot_put_full(struct magazine_depot *depot, struct magazine *mag)
+{
+	mag->next = depot->full;
+	depot->full = mag;
+	depot->nr_full++;
+}
+
+static struct magazine *depot_get_empty(struct magazine_depot *depot)
+{
+	struct magazine *mag = depot->empty;
+	if (mag)
+		depot->empty = mag->next;
+	else if (magazine_cache)
+	{
+		mag = kmem_cache_alloc_flags(magazine_cache, GFP_ATOMIC);
+		if (mag)
+			mag->rounds = 0;
+	}
+	return mag;
+}
+
+static void depot_put_empty(struct magazine_depot *depot, struct magazine *mag)
+{
+	mag->next = depot->empty;
+	depot->empty = mag;
+}
+
+static void *magazine_alloc(size_t size)
 {
+	uint32_t class = log2(size - 1) + 1 - KMALLOC_MIN_SHIFT;
+	uint32_t flags = local_irq_save();
+	struct magazine_cpu_cache *cc = &magazine_cpu_caches[smp_processor_id()][class];
+	void *obj = NULL;
+
+	if (!cc->loaded || !cc->loaded->rounds)
+	{
+		struct magazine *tmp = cc->previous;
+		if (tmp && tmp->rounds)
+		{
+			cc->previous = cc->loaded;
+			cc->loaded = tmp;
+		}
+		else if ((tmp = depot_get_full(&magazine_depots[class])))
+		{
+			if (cc->previous)
+				depot_put_empty(&magazine_depots[class], cc->previous);
+			cc->previous = cc->loaded;
+			cc->loaded = tmp;
+		}
+	}
+
+	if (cc->loaded && cc->loaded->rounds)
+	{
+		obj = cc->loaded->objs[--cc->loaded->rounds];
+		get_block_ptr(obj)->cached = false;
+	}
+
+	local_irq_restore(flags);
+	return obj;
+}
+
+// return false if the object has to go back to the heap
+static bool magazine_free(void *obj, size_t size)
+{
+	uint32_t class = log2(size) - KMALLOC_MIN_SHIFT;
+	uint32_t flags = local_irq_save();
+	struct magazine_cpu_cache *cc = &magazine_cpu_caches[smp_processor_id()][class];
+	struct magazine_depot *depot = &magazine_depots[class];
+
+	if (!cc->loaded || cc->loaded->rounds == MAGAZINE_SIZE)
+	{
+		struct magazine *tmp = cc->previous;
+		if (tmp && tmp->rounds < MAGAZINE_SIZE)
+		{
+			cc->previous = cc->loaded;
+			cc->loaded = tmp;
+		}
+		else if ((tmp = depot_get_empty(depot)))
+		{
+			if (cc->previous)
+			{
+				// bound the memory parked in magazines, a surplus full magazine drains into the heap
+				if (depot->nr_full < DEPOT_MAX_FULL)
+					depot_put_full(depot, cc->previous);
+				else
+				{
+					while (cc->previous->rounds)
+					{
+						void *cached_obj = cc->previous->objs[--cc->previous->rounds];
+						get_block_ptr(cached_obj)->cached = false;
+						heap_free(cached_obj, false);
+					}
+					depot_put_empty(depot, cc->previous);
+				}
+			}
+			cc->previous = cc->loaded;
+			cc->loaded = tmp;
+		}
+	}
+
+	bool cached = cc->loaded && cc->loaded->rounds < MAGAZINE_SIZE;
+	if (cached)
+	{
+		cc->loaded->objs[cc->loaded->rounds++] = obj;
+		get_block_ptr(obj)->cached = true;
+	}
+
+	local_irq_restore(flags);
+	return cached;
+}
+
+static void *__kmalloc(size_t size, uint32_t flags)
+{
+	if (size <= 0)
+		return NULL;
+
+	size = max_t(size_t, ALIGN_UP(size, 4), BLOCK_MIN_SIZE);
+
+	void *ptr = NULL;
+	if (size <= (1 << MAGAZINE_MAX_SHIFT))
+		ptr = magazine_alloc(size);
 	if (!ptr)
-		return;
+		ptr = heap_alloc(size, flags);
+
+	if (ptr && (flags & GFP_ZERO))
+		memset(ptr, 0, size);
+	return ptr;
+}
 
+static void __kfree(void *ptr)
+{
 	struct block_meta *block = get_block_ptr(ptr);
 	assert_kblock_valid(block);
-	block->free = true;
+	assert(!block->free);
+
+	if (block->size < (1 << (MAGAZINE_MAX_SHIFT + 1)) && magazine_free(ptr, block->size))
+		return;
+
+	heap_free(ptr, !in_interrupt());
 }
 
 // NOTE: MQ 2019-11-24
@@ -138,7 +567,7 @@ void kfree(void *ptr)
 // ------------------- m - sizeof(struct block_meta)
 // |                 | empty object (>= 1)
 // ------------------- padding - sizeof(struct block_meta)
-void *kalign_heap(size_t size)
+static void *__kalign_heap(size_t size)
 {
 	uint32_t heap_addr = (uint32_t)sbrk(0);
 
@@ -146,34 +575,221 @@ void *kalign_heap(size_t size)
 		return NULL;
 
 	uint32_t padding_size = div_ceil(heap_addr, size) * size - heap_addr;
-	uint32_t required_size = sizeof(struct block_meta) * 2;
+	uint32_t required_size = sizeof(struct block_meta) * 2 + sizeof(struct block_footer) + BLOCK_MIN_SIZE;
 
 	while (padding_size <= KERNEL_HEAP_TOP)
 	{
-		if (padding_size > required_size)
+		if (padding_size >= required_size)
 		{
-			struct block_meta *last = kblocklist;
-			while (!last->next)
-				last = last->next;
-			struct block_meta *block = request_space(last, padding_size - required_size);
-			return block + 1;
+			struct block_meta *block = request_space(padding_size - required_size + BLOCK_MIN_SIZE);
+			return block ? block + 1 : NULL;
 		}
 		padding_size += size;
 	}
 	return NULL;
 }
 
-void *krealloc(void *ptr, size_t size)
+void *kalign_heap(size_t size)
+{
+	uint32_t flags = local_irq_save();
+	void *ptr = __kalign_heap(size);
+	local_irq_restore(flags);
+	return ptr;
+}
+
+// NOTE: Shrink by splitting the tail off, grow by absorbing a free successor or, for the last block, by sbrk.
+// Called with interrupts off, false if the block has to move
+static bool heap_resize(struct block_meta *block, size_t size)
 {
-	if (!ptr && size == 0)
+	if (size <= block->size)
+	{
+		split_block(block, size);
+		return true;
+	}
+
+	struct block_meta *next = get_next_block(block);
+	size_t merged_size = block->size + sizeof(struct block_footer) + sizeof(struct block_meta) + (next ? next->size : 0);
+	if (next && next->free && merged_size >= size)
+	{
+		// back the pages first, so running out of frames leaves both blocks as they were
+		if (next->trimmed && !sbrk_populate_pages((uint32_t)next, min((uint32_t)(get_block_footer(next) + 1), block_used_end(block, size))))
+			return false;
+
+		freelist_remove(next);
+		if (next == kblocklast)
+			kblocklast = block;
+		set_block(block, merged_size, false);
+		block->trimmed = next->trimmed;
+		split_block(block, size);
+		block->trimmed = false;
+		return true;
+	}
+
+	if (block == kblocklast && sbrk(size - block->size))
 	{
-		kfree(ptr);
+		set_block(block, size, false);
+		return true;
+	}
+	return false;
+}
+
+// NOTE: Only when the block really has to move is the old payload copied, and then with 50% headroom
+// so a buffer which keeps growing is copied O(log n) times
+static void *__krealloc(void *ptr, size_t size)
+{
+	if (!ptr)
+		return __kmalloc(size, GFP_KERNEL);
+	if (size == 0)
+	{
+		__kfree(ptr);
 		return NULL;
 	}
-	else if (!ptr)
-		return kcalloc(size, sizeof(char));
 
-	void *newptr = kcalloc(size, sizeof(char));
-	memcpy(newptr, ptr, size);
+	struct block_meta *block = get_block_ptr(ptr);
+	assert_kblock_valid(block);
+
+	size = max_t(size_t, ALIGN_UP(size, 4), BLOCK_MIN_SIZE);
+
+	uint32_t flags = local_irq_save();
+	bool resized = heap_resize(block, size);
+	local_irq_restore(flags);
+	if (resized)
+		return ptr;
+
+	void *newptr = __kmalloc(max_t(size_t, size, ALIGN_UP(block->size + block->size / 2, 4)), GFP_KERNEL);
+	if (!newptr)
+		return NULL;
+
+	memcpy(newptr, ptr, block->size);
+	__kfree(ptr);
 	return newptr;
-}
\ No newline at end of file
+}
+
+#ifdef CONFIG_KMALLOC_PROFILE
+extern volatile uint32_t jiffies;
+
+static void profile_alloc(void *ptr, void *caller)
+{
+	if (!ptr)
+		return;
+
+	// the site table is shared with allocations from interrupt context
+	uint32_t flags = local_irq_save();
+	struct block_meta *block = get_block_ptr(ptr);
+	block->caller = (uint32_t)caller;
+	block->timestamp = jiffies;
+	block->size_class = log2(block->size);
+	kmalloc_profile_alloc(block->caller, block->size, block->size_class);
+	local_irq_restore(flags);
+}
+
+static void profile_free(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	uint32_t flags = local_irq_save();
+	struct block_meta *block = get_block_ptr(ptr);
+	kmalloc_profile_free(block->caller, block->size);
+	local_irq_restore(flags);
+}
+
+void kmalloc_for_each_allocated(void (*fn)(uint32_t caller, uint32_t timestamp, size_t size))
+{
+	uint32_t flags = local_irq_save();
+	for (struct block_meta *block = kblocklist; block; block = get_next_block(block))
+		if (!block->free && !block->cached)
+			fn(block->caller, block->timestamp, block->size);
+	local_irq_restore(flags);
+}
+#else
+#define profile_alloc(ptr, caller) ((void)0)
+#define profile_free(ptr) ((void)0)
+#endif
+
+void *kmalloc_flags(size_t size, uint32_t flags)
+{
+	void *ptr = __kmalloc(size, flags);
+	profile_alloc(ptr, __builtin_return_address(0));
+	return ptr;
+}
+
+void *kmalloc(size_t size)
+{
+	void *ptr = __kmalloc(size, GFP_KERNEL);
+	profile_alloc(ptr, __builtin_return_address(0));
+	return ptr;
+}
+
+void *kcalloc(size_t n, size_t size)
+{
+	if (size && n > SIZE_MAX / size)
+		return NULL;
+
+	void *ptr = __kmalloc(n * size, GFP_ZERO);
+	profile_alloc(ptr, __builtin_return_address(0));
+	return ptr;
+}
+
+void kfree(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	profile_free(ptr);
+	__kfree(ptr);
+}
+
+void *krealloc(void *ptr, size_t size)
+{
+	profile_free(ptr);
+
+	void *newptr = __krealloc(ptr, size);
+	// a failed move leaves the old block alive
+	profile_alloc(newptr ? newptr : (size ? ptr : NULL), __builtin_return_address(0));
+	return newptr;
+}
+
+void kmalloc_get_stats(struct kmalloc_stats *stats)
+{
+	memset(stats, 0, sizeof(struct kmalloc_stats));
+
+	uint32_t flags = local_irq_save();
+	stats->heap_size = (uint32_t)sbrk(0) - KERNEL_HEAP_BOTTOM;
+
+	for (struct block_meta *block = kblocklist; block; block = get_next_block(block))
+		if (block->free)
+		{
+			stats->free_blocks++;
+			stats->free_bytes += block->size;
+			stats->largest_free = max(stats->largest_free, (uint32_t)block->size);
+		}
+		else if (block->cached)
+		{
+			stats->cached_blocks++;
+			stats->cached_bytes += block->size;
+		}
+		else
+		{
+			stats->used_blocks++;
+			stats->used_bytes += block->size;
+		}
+	local_irq_restore(flags);
+}
+
+void kmalloc_init()
+{
+	serial_write("KMALLOC: Initializing\n");
+
+	magazine_cache = kmem_cache_create("magazine", sizeof(struct magazine), 0, NULL);
+	for (int class = 0; class < MAGAZINE_CLASSES; ++class)
+		for (int i = 0; i < DEPOT_RESERVE_EMPTY; ++i)
+		{
+			struct magazine *mag = kmem_cache_alloc(magazine_cache);
+			assert(mag);
+			mag->rounds = 0;
+			depot_put_empty(&magazine_depots[class], mag);
+		}
+
+	serial_write("KMALLOC: Done\n");
+}
@@ -0,0 +1,104 @@
+#include "mempool.h"
+
+#include <cpu/hal.h>
+#include <utils/debug.h>
+
+#include "vmm.h"
+
+struct mempool *mempool_create(uint32_t min_nr, mempool_alloc_t *alloc_fn, mempool_free_t *free_fn, void *pool_data)
+{
+	struct mempool *pool = kcalloc(1, sizeof(struct mempool));
+	if (!pool)
+		return NULL;
+
+	pool->elements = kmalloc(min_nr * sizeof(void *));
+	if (!pool->elements)
+	{
+		kfree(pool);
+		return NULL;
+	}
+
+	pool->min_nr = min_nr;
+	pool->pool_data = pool_data;
+	pool->alloc = alloc_fn;
+	pool->free = free_fn;
+
+	while (pool->curr_nr < min_nr)
+	{
+		void *element = alloc_fn(GFP_KERNEL, pool_data);
+		if (!element)
+		{
+			mempool_destroy(pool);
+			return NULL;
+		}
+		pool->elements[pool->curr_nr++] = element;
+	}
+	return pool;
+}
+
+void mempool_destroy(struct mempool *pool)
+{
+	while (pool->curr_nr)
+		pool->free(pool->elements[--pool->curr_nr], pool->pool_data);
+
+	kfree(pool->elements);
+	kfree(pool);
+}
+
+// NOTE: GFP_ATOMIC (interrupt, bottom half) takes an element from the reserve first and only then
+// asks the backing allocator, which must not touch page tables for GFP_ATOMIC either.
+// Other callers use the backing allocator and fall back to the reserve
+void *mempool_alloc(struct mempool *pool, uint32_t gfp_mask)
+{
+	void *element = NULL;
+
+	if (!(gfp_mask & GFP_ATOMIC) && (element = pool->alloc(gfp_mask, pool->pool_data)))
+		return element;
+
+	uint32_t flags = local_irq_save();
+	if (pool->curr_nr)
+		element = pool->elements[--pool->curr_nr];
+	local_irq_restore(flags);
+
+	if (!element && (gfp_mask & GFP_ATOMIC))
+		element = pool->alloc(gfp_mask, pool->pool_data);
+	return element;
+}
+
+// refill the reserve before anything goes back to the backing allocator
+void mempool_free(void *element, struct mempool *pool)
+{
+	if (!element)
+		return;
+
+	uint32_t flags = local_irq_save();
+	if (pool->curr_nr < pool->min_nr)
+	{
+		pool->elements[pool->curr_nr++] = element;
+		local_irq_restore(flags);
+		return;
+	}
+	local_irq_restore(flags);
+
+	pool->free(element, pool->pool_data);
+}
+
+void *mempool_alloc_slab(uint32_t gfp_mask, void *pool_data)
+{
+	return kmem_cache_alloc_flags(pool_data, gfp_mask);
+}
+
+void mempool_free_slab(void *element, void *pool_data)
+{
+	kmem_cache_free(pool_data, element);
+}
+
+void *mempool_kmalloc(uint32_t gfp_mask, void *pool_data)
+{
+	return kmalloc_flags((size_t)pool_data, gfp_mask);
+}
+
+void mempool_kfree(void *element, void *pool_data)
+{
+	kfree(element);
+}
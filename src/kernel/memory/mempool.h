@@ -0,0 +1,44 @@
+#ifndef MEMORY_MEMPOOL_H
+#define MEMORY_MEMPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slab.h"
+
+typedef void *(mempool_alloc_t)(uint32_t gfp_mask, void *pool_data);
+typedef void(mempool_free_t)(void *element, void *pool_data);
+
+// a reserve of at least `min_nr` preallocated elements in front of another allocator
+struct mempool
+{
+	uint32_t min_nr;
+	uint32_t curr_nr;
+	void **elements;
+
+	void *pool_data;
+	mempool_alloc_t *alloc;
+	mempool_free_t *free;
+};
+
+struct mempool *mempool_create(uint32_t min_nr, mempool_alloc_t *alloc_fn, mempool_free_t *free_fn, void *pool_data);
+void mempool_destroy(struct mempool *pool);
+void *mempool_alloc(struct mempool *pool, uint32_t gfp_mask);
+void mempool_free(void *element, struct mempool *pool);
+
+void *mempool_alloc_slab(uint32_t gfp_mask, void *pool_data);
+void mempool_free_slab(void *element, void *pool_data);
+void *mempool_kmalloc(uint32_t gfp_mask, void *pool_data);
+void mempool_kfree(void *element, void *pool_data);
+
+static inline struct mempool *mempool_create_slab_pool(uint32_t min_nr, struct kmem_cache *cache)
+{
+	return mempool_create(min_nr, mempool_alloc_slab, mempool_free_slab, cache);
+}
+
+static inline struct mempool *mempool_create_kmalloc_pool(uint32_t min_nr, size_t size)
+{
+	return mempool_create(min_nr, mempool_kmalloc, mempool_kfree, (void *)size);
+}
+
+#endif
@@ -175,11 +175,27 @@ void pmm_free_block(void *p)
 	uint32_t addr = (uint32_t)p;
 	uint32_t frame = addr / PMM_FRAME_SIZE;
 
+	assert(memory_bitmap_test(frame));
 	memory_bitmap_unset(frame);
 
 	used_frames--;
 }
 
+// release a batch of (not necessarily contiguous) frames with a single bookkeeping update
+void pmm_free_blocks(uint32_t *paddrs, size_t num)
+{
+	for (size_t i = 0; i < num; ++i)
+	{
+		uint32_t frame = paddrs[i] / PMM_FRAME_SIZE;
+
+		// a double free would make used_frames drift
+		assert(memory_bitmap_test(frame));
+		memory_bitmap_unset(frame);
+	}
+
+	used_frames -= num;
+}
+
 void pmm_mark_used_addr(uint32_t paddr)
 {
 	uint32_t frame = paddr / PMM_FRAME_SIZE;
@@ -18,6 +18,7 @@ void pmm_init(struct multiboot_tag_basic_meminfo *, struct multiboot_tag_mmap *)
 void *pmm_alloc_block();
 void *pmm_alloc_blocks(size_t num);
 void pmm_free_block(void *block);
+void pmm_free_blocks(uint32_t *paddrs, size_t num);
 void pmm_mark_used_addr(uint32_t paddr);
 uint32_t get_total_frames();
 
@@ -0,0 +1,176 @@
+#include "rmap.h"
+
+#include <utils/debug.h>
+#include <utils/string.h>
+
+#include "slab.h"
+
+static struct rmap_head *rmap_heads = NULL;
+static struct kmem_cache *rmap_chain_cache;
+static uint32_t rmap_frames = 0;
+
+void rmap_init()
+{
+	serial_write("RMAP: Initializing\n");
+
+	rmap_frames = get_total_frames();
+	rmap_heads = kcalloc(rmap_frames, sizeof(struct rmap_head));
+	rmap_chain_cache = kmem_cache_create("rmap_chain", sizeof(struct rmap_chain), 0, NULL);
+
+	serial_write("RMAP: Done\n");
+}
+
+// frames outside of ram (mmio) or mapped before rmap is ready are not tracked
+static struct rmap_head *rmap_get_head(uint32_t paddr)
+{
+	uint32_t frame = paddr / PMM_FRAME_SIZE;
+
+	if (!rmap_heads || frame >= rmap_frames)
+		return NULL;
+	return &rmap_heads[frame];
+}
+
+static void rmap_chain_insert(struct rmap_head *head, struct pdirectory *dir, uint32_t vaddr)
+{
+	for (struct rmap_chain *chain = head->chain; chain; chain = chain->next)
+		for (int i = 0; i < RMAP_CHAIN_ENTRIES; ++i)
+			if (!chain->entries[i].dir)
+			{
+				chain->entries[i].dir = dir;
+				chain->entries[i].vaddr = vaddr;
+				return;
+			}
+
+	struct rmap_chain *chain = kmem_cache_alloc(rmap_chain_cache);
+	memset(chain, 0, sizeof(struct rmap_chain));
+	chain->entries[0].dir = dir;
+	chain->entries[0].vaddr = vaddr;
+	chain->next = head->chain;
+	head->chain = chain;
+}
+
+static bool rmap_chain_is_empty(struct rmap_chain *chain)
+{
+	for (int i = 0; i < RMAP_CHAIN_ENTRIES; ++i)
+		if (chain->entries[i].dir)
+			return false;
+	return true;
+}
+
+void rmap_add(uint32_t paddr, struct pdirectory *dir, uint32_t vaddr)
+{
+	struct rmap_head *head = rmap_get_head(paddr);
+	if (!head)
+		return;
+
+	uint32_t count = head->vaddr_count & RMAP_COUNT_MASK;
+	vaddr &= PAGE_MASK;
+	assert(count < RMAP_COUNT_MASK);
+
+	if (count == 0)
+	{
+		head->dir = dir;
+		head->vaddr_count = vaddr | 1;
+		return;
+	}
+
+	if (count == 1)
+	{
+		struct pdirectory *single_dir = head->dir;
+		uint32_t single_vaddr = head->vaddr_count & PAGE_MASK;
+
+		head->chain = NULL;
+		rmap_chain_insert(head, single_dir, single_vaddr);
+	}
+
+	rmap_chain_insert(head, dir, vaddr);
+	head->vaddr_count = count + 1;
+}
+
+// return the number of mappings which are left for the frame
+uint32_t rmap_remove(uint32_t paddr, struct pdirectory *dir, uint32_t vaddr)
+{
+	struct rmap_head *head = rmap_get_head(paddr);
+	if (!head)
+		return 0;
+
+	uint32_t count = head->vaddr_count & RMAP_COUNT_MASK;
+	vaddr &= PAGE_MASK;
+
+	if (count == 0)
+		return 0;
+
+	if (count == 1)
+	{
+		// the page tables and the rmap disagree, the frame would be leaked or freed while still mapped
+		assert(head->dir == dir && (head->vaddr_count & PAGE_MASK) == vaddr);
+
+		head->dir = NULL;
+		head->vaddr_count = 0;
+		return 0;
+	}
+
+	struct rmap_chain **link = &head->chain;
+	for (struct rmap_chain *chain = head->chain; chain; link = &chain->next, chain = chain->next)
+		for (int i = 0; i < RMAP_CHAIN_ENTRIES; ++i)
+			if (chain->entries[i].dir == dir && chain->entries[i].vaddr == vaddr)
+			{
+				chain->entries[i].dir = NULL;
+				if (rmap_chain_is_empty(chain))
+				{
+					*link = chain->next;
+					kmem_cache_free(rmap_chain_cache, chain);
+				}
+				count--;
+				goto removed;
+			}
+	assert_not_reached();
+	return count;
+
+removed:
+	// NOTE: Empty chains are released eagerly, so a single remaining mapping lives in the only chain left
+	if (count == 1)
+	{
+		struct rmap_chain *chain = head->chain;
+		for (int i = 0; i < RMAP_CHAIN_ENTRIES; ++i)
+			if (chain->entries[i].dir)
+			{
+				head->dir = chain->entries[i].dir;
+				head->vaddr_count = chain->entries[i].vaddr | 1;
+				break;
+			}
+		kmem_cache_free(rmap_chain_cache, chain);
+	}
+	else
+		head->vaddr_count = count;
+
+	return count;
+}
+
+uint32_t rmap_mapcount(uint32_t paddr)
+{
+	struct rmap_head *head = rmap_get_head(paddr);
+	return head ? head->vaddr_count & RMAP_COUNT_MASK : 0;
+}
+
+void rmap_walk(uint32_t paddr, rmap_walk_fn fn, void *arg)
+{
+	struct rmap_head *head = rmap_get_head(paddr);
+	if (!head)
+		return;
+
+	uint32_t count = head->vaddr_count & RMAP_COUNT_MASK;
+	if (count == 0)
+		return;
+
+	if (count == 1)
+	{
+		fn(head->dir, head->vaddr_count & PAGE_MASK, arg);
+		return;
+	}
+
+	for (struct rmap_chain *chain = head->chain; chain; chain = chain->next)
+		for (int i = 0; i < RMAP_CHAIN_ENTRIES; ++i)
+			if (chain->entries[i].dir && !fn(chain->entries[i].dir, chain->entries[i].vaddr, arg))
+				return;
+}
@@ -0,0 +1,47 @@
+#ifndef MEMORY_RMAP_H
+#define MEMORY_RMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vmm.h"
+
+#define RMAP_COUNT_MASK 0xfff
+#define RMAP_CHAIN_ENTRIES 7
+
+struct rmap_entry
+{
+	struct pdirectory *dir;
+	uint32_t vaddr;
+};
+
+// overflow storage, only used once a frame is mapped more than once
+struct rmap_chain
+{
+	struct rmap_chain *next;
+	struct rmap_entry entries[RMAP_CHAIN_ENTRIES];
+};
+
+// one per physical frame, 8 bytes
+// mapcount == 1 -> `dir` + page aligned vaddr in `vaddr_count` is the only mapping (fast path)
+// mapcount > 1  -> `chain` holds every mapping, vaddr bits of `vaddr_count` are unused
+struct rmap_head
+{
+	union
+	{
+		struct pdirectory *dir;
+		struct rmap_chain *chain;
+	};
+	uint32_t vaddr_count;
+};
+
+// return false to stop walking
+typedef bool (*rmap_walk_fn)(struct pdirectory *dir, uint32_t vaddr, void *arg);
+
+void rmap_init();
+void rmap_add(uint32_t paddr, struct pdirectory *dir, uint32_t vaddr);
+uint32_t rmap_remove(uint32_t paddr, struct pdirectory *dir, uint32_t vaddr);
+uint32_t rmap_mapcount(uint32_t paddr);
+void rmap_walk(uint32_t paddr, rmap_walk_fn fn, void *arg);
+
+#endif
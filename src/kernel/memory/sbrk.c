@@ -1,6 +1,5 @@
 #include <include/errno.h>
 #include <utils/math.h>
-#include <utils/string.h>
 
 #include "vmm.h"
 
@@ -19,6 +18,8 @@ void *sbrk(size_t n)
 	else
 	{
 		uint32_t phyiscal_addr = (uint32_t)pmm_alloc_blocks(div_ceil(n - kernel_remaining_from_last_used, PMM_FRAME_SIZE));
+		if (!phyiscal_addr)
+			return NULL;
 		uint32_t page_addr = div_ceil(kernel_heap_current, PMM_FRAME_SIZE) * PMM_FRAME_SIZE;
 		for (; page_addr < kernel_heap_current + n; page_addr += PMM_FRAME_SIZE, phyiscal_addr += PMM_FRAME_SIZE)
 			vmm_map_address(vmm_get_directory(),
@@ -28,7 +29,39 @@ void *sbrk(size_t n)
 		kernel_remaining_from_last_used = page_addr - (kernel_heap_current + n);
 	}
 
+	// NOTE: Heap memory is handed out uninitialized, callers which need zeroes ask kmalloc for GFP_ZERO
 	kernel_heap_current += n;
-	memset(heap_base, 0, n);
 	return heap_base;
-}
\ No newline at end of file
+}
+static bool sbrk_is_page_mapped(uint32_t page_addr)
+{
+	return vmm_get_physical_address(page_addr, true) & I86_PTE_PRESENT;
+}
+
+// back every page which overlaps [start, end) and was released before, false when the pmm runs dry
+bool sbrk_populate_pages(uint32_t start, uint32_t end)
+{
+	for (uint32_t page_addr = ALIGN_DOWN(start, PMM_FRAME_SIZE); page_addr < end; page_addr += PMM_FRAME_SIZE)
+	{
+		if (sbrk_is_page_mapped(page_addr))
+			continue;
+
+		uint32_t paddr = (uint32_t)pmm_alloc_block();
+		if (!paddr)
+			return false;
+		vmm_map_address(vmm_get_directory(), page_addr, paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE);
+	}
+	return true;
+}
+
+// lower the heap top by n bytes, pages which are no longer used at all go back to the pmm
+void sbrk_trim(size_t n)
+{
+	uint32_t mapped_end = kernel_heap_current + kernel_remaining_from_last_used;
+
+	kernel_heap_current -= n;
+
+	uint32_t page_addr = PAGE_ALIGN(kernel_heap_current);
+	vmm_free_range(page_addr, mapped_end);
+	kernel_remaining_from_last_used = page_addr - kernel_heap_current;
+}
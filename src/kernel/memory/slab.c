@@ -0,0 +1,210 @@
+#include "slab.h"
+
+#include <cpu/hal.h>
+#include <cpu/softirq.h>
+#include <stdbool.h>
+#include <utils/debug.h>
+#include <utils/math.h>
+#include <utils/string.h>
+
+#include "vmm.h"
+
+#define SLAB_WINDOW_PAGES ((KERNEL_SLAB_TOP - KERNEL_SLAB_BOTTOM) / PMM_FRAME_SIZE)
+
+static uint32_t slab_window_bitmap[SLAB_WINDOW_PAGES / 32];
+static uint32_t slab_window_hint = 0;
+
+static struct kmem_cache cache_cache;
+static LIST_HEAD(cache_chain);
+
+// NOTE: Slabs are exactly one page and page aligned inside the slab window,
+// so the owning slab of any object is found by rounding its address down
+static void *slab_page_alloc()
+{
+	for (uint32_t i = slab_window_hint; i < SLAB_WINDOW_PAGES / 32; ++i)
+	{
+		if (slab_window_bitmap[i] == 0xffffffff)
+			continue;
+
+		uint32_t bit = __builtin_ctz(~slab_window_bitmap[i]);
+		uint32_t paddr = (uint32_t)pmm_alloc_block();
+		if (!paddr)
+			return NULL;
+
+		slab_window_bitmap[i] |= 1u << bit;
+		slab_window_hint = i;
+
+		uint32_t vaddr = KERNEL_SLAB_BOTTOM + (i * 32 + bit) * PMM_FRAME_SIZE;
+		vmm_map_address(vmm_get_directory(), vaddr, paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE);
+		return (void *)vaddr;
+	}
+
+	return NULL;
+}
+
+static void slab_page_free(void *page)
+{
+	uint32_t vaddr = (uint32_t)page;
+	uint32_t paddr = vmm_get_physical_address(vaddr, true) & PAGE_MASK;
+	uint32_t index = (vaddr - KERNEL_SLAB_BOTTOM) / PMM_FRAME_SIZE;
+
+	vmm_unmap_address(vmm_get_directory(), vaddr);
+	pmm_free_block((void *)paddr);
+
+	slab_window_bitmap[index / 32] &= ~(1u << (index % 32));
+	if (index / 32 < slab_window_hint)
+		slab_window_hint = index / 32;
+}
+
+static uint32_t slab_mgmt_size(struct kmem_cache *cache, uint32_t num)
+{
+	return ALIGN_UP(sizeof(struct slab) + num * sizeof(uint16_t), cache->align);
+}
+
+static void kmem_cache_setup(struct kmem_cache *cache, const char *name, size_t size, size_t align, void (*ctor)(void *))
+{
+	cache->name = name;
+	cache->object_size = size;
+	cache->align = max_t(size_t, align, SLAB_MIN_ALIGN);
+	cache->size = ALIGN_UP(size, cache->align);
+	cache->ctor = ctor;
+
+	uint32_t num = (PMM_FRAME_SIZE - sizeof(struct slab)) / (cache->size + sizeof(uint16_t));
+	while (num && slab_mgmt_size(cache, num) + num * cache->size > PMM_FRAME_SIZE)
+		num--;
+	assert(num > 0);
+	cache->num = num;
+
+	// spread objects of consecutive slabs over different cache lines with the leftover space
+	uint32_t leftover = PMM_FRAME_SIZE - slab_mgmt_size(cache, num) - num * cache->size;
+	cache->colour = leftover / cache->align + 1;
+	cache->colour_next = 0;
+
+	INIT_LIST_HEAD(&cache->slabs_full);
+	INIT_LIST_HEAD(&cache->slabs_partial);
+	INIT_LIST_HEAD(&cache->slabs_free);
+	list_add_tail(&cache->sibling, &cache_chain);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *))
+{
+	if (!cache_cache.size)
+		kmem_cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0, NULL);
+
+	struct kmem_cache *cache = kmem_cache_alloc(&cache_cache);
+	if (!cache)
+		return NULL;
+
+	kmem_cache_setup(cache, name, size, align, ctor);
+	return cache;
+}
+
+static struct slab *kmem_cache_grow(struct kmem_cache *cache)
+{
+	struct slab *slab = slab_page_alloc();
+	if (!slab)
+		return NULL;
+
+	uint32_t colour_offset = cache->colour_next * cache->align;
+	cache->colour_next = (cache->colour_next + 1) % cache->colour;
+
+	slab->cache = cache;
+	slab->s_mem = (char *)slab + slab_mgmt_size(cache, cache->num) + colour_offset;
+	slab->inuse = 0;
+	slab->free_top = cache->num;
+	for (uint32_t i = 0; i < cache->num; ++i)
+	{
+		slab->free[i] = cache->num - 1 - i;
+		if (cache->ctor)
+			cache->ctor((char *)slab->s_mem + i * cache->size);
+	}
+
+	list_add(&slab->sibling, &cache->slabs_free);
+	return slab;
+}
+
+// GFP_ATOMIC never grows the cache (which maps a new page), only existing slabs are used.
+// Atomic allocations and frees can come from interrupt context, so the slab lists are only
+// changed with interrupts off
+void *kmem_cache_alloc_flags(struct kmem_cache *cache, uint32_t flags)
+{
+	struct slab *slab;
+	uint32_t irq_flags = local_irq_save();
+
+	if (!list_empty(&cache->slabs_partial))
+		slab = list_first_entry(&cache->slabs_partial, struct slab, sibling);
+	else if (!list_empty(&cache->slabs_free))
+		slab = list_first_entry(&cache->slabs_free, struct slab, sibling);
+	else if ((flags & GFP_ATOMIC) || !(slab = kmem_cache_grow(cache)))
+	{
+		local_irq_restore(irq_flags);
+		return NULL;
+	}
+
+	uint16_t index = slab->free[--slab->free_top];
+	slab->inuse++;
+
+	if (slab->free_top == 0)
+		list_move(&slab->sibling, &cache->slabs_full);
+	else if (slab->inuse == 1)
+		list_move(&slab->sibling, &cache->slabs_partial);
+
+	local_irq_restore(irq_flags);
+	return (char *)slab->s_mem + index * cache->size;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	return kmem_cache_alloc_flags(cache, GFP_KERNEL);
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	if (!obj)
+		return;
+
+	struct slab *slab = PTR_ALIGN_DOWN((struct slab *)obj, PMM_FRAME_SIZE);
+	assert(slab->cache == cache);
+
+	uint32_t flags = local_irq_save();
+	bool was_full = slab->free_top == 0;
+	slab->free[slab->free_top++] = ((char *)obj - (char *)slab->s_mem) / cache->size;
+	slab->inuse--;
+
+	if (slab->inuse == 0)
+	{
+		// keep one empty slab around so alloc/free at a slab boundary doesn't map/unmap every time,
+		// and never unmap from interrupt context
+		if (!list_empty(&cache->slabs_free) && !in_interrupt())
+		{
+			list_del(&slab->sibling);
+			slab_page_free(slab);
+		}
+		else
+			list_move(&slab->sibling, &cache->slabs_free);
+	}
+	else if (was_full)
+		list_move(&slab->sibling, &cache->slabs_partial);
+	local_irq_restore(flags);
+}
+
+void kmem_cache_shrink(struct kmem_cache *cache)
+{
+	uint32_t flags = local_irq_save();
+	struct slab *slab, *next;
+	list_for_each_entry_safe(slab, next, &cache->slabs_free, sibling)
+	{
+		list_del(&slab->sibling);
+		slab_page_free(slab);
+	}
+	local_irq_restore(flags);
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+	assert(list_empty(&cache->slabs_full) && list_empty(&cache->slabs_partial));
+
+	kmem_cache_shrink(cache);
+	list_del(&cache->sibling);
+	kmem_cache_free(&cache_cache, cache);
+}
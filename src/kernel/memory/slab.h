@@ -0,0 +1,44 @@
+#ifndef MEMORY_SLAB_H
+#define MEMORY_SLAB_H
+
+#include <include/list.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_MIN_ALIGN 4
+
+struct slab
+{
+	struct list_head sibling;
+	struct kmem_cache *cache;
+	void *s_mem;	   // first object, shifted by the slab's colour
+	uint32_t inuse;
+	uint32_t free_top;
+	uint16_t free[];   // stack of free object indexes, objects themselves carry no header
+};
+
+struct kmem_cache
+{
+	const char *name;
+	size_t object_size;
+	size_t size;  // object_size rounded up to align
+	size_t align;
+	uint32_t num;  // objects per slab
+	uint32_t colour;  // number of distinct colours which fit in the slab's leftover
+	uint32_t colour_next;
+	void (*ctor)(void *);
+
+	struct list_head slabs_full;
+	struct list_head slabs_partial;
+	struct list_head slabs_free;
+	struct list_head sibling;
+};
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *));
+void kmem_cache_destroy(struct kmem_cache *cache);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void *kmem_cache_alloc_flags(struct kmem_cache *cache, uint32_t flags);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+void kmem_cache_shrink(struct kmem_cache *cache);
+
+#endif
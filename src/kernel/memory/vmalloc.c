@@ -0,0 +1,181 @@
+#include <include/list.h>
+#include <utils/debug.h>
+#include <utils/math.h>
+#include <utils/string.h>
+
+#include "slab.h"
+#include "vmm.h"
+
+#define VMALLOC_BUSY_BUCKETS 64
+
+// a range of virtual addresses [start, end) inside the vmalloc window
+struct vm_range
+{
+	uint32_t start;
+	uint32_t end;
+	struct list_head sibling;
+};
+
+static struct kmem_cache *vm_range_cache;
+static LIST_HEAD(vmalloc_free_ranges);	// sorted by address, adjacent ranges are always merged
+// busy ranges are hashed by their start page, vfree only gets the address back
+static struct list_head vmalloc_busy_ranges[VMALLOC_BUSY_BUCKETS];
+
+static struct list_head *vmalloc_busy_bucket(uint32_t start)
+{
+	return &vmalloc_busy_ranges[(start / PMM_FRAME_SIZE) % VMALLOC_BUSY_BUCKETS];
+}
+
+void vmalloc_init()
+{
+	serial_write("VMALLOC: Initializing\n");
+
+	vm_range_cache = kmem_cache_create("vm_range", sizeof(struct vm_range), 0, NULL);
+	for (int i = 0; i < VMALLOC_BUSY_BUCKETS; ++i)
+		INIT_LIST_HEAD(&vmalloc_busy_ranges[i]);
+
+	struct vm_range *range = kmem_cache_alloc(vm_range_cache);
+	assert(range);
+	range->start = VMALLOC_START;
+	range->end = VMALLOC_END;
+	list_add(&range->sibling, &vmalloc_free_ranges);
+
+	serial_write("VMALLOC: Done\n");
+}
+
+static struct vm_range *vmalloc_alloc_range(uint32_t size)
+{
+	struct vm_range *iter;
+	list_for_each_entry(iter, &vmalloc_free_ranges, sibling)
+	{
+		if (iter->end - iter->start < size)
+			continue;
+
+		struct vm_range *range = kmem_cache_alloc(vm_range_cache);
+		if (!range)
+			return NULL;
+		range->start = iter->start;
+		range->end = iter->start + size;
+
+		iter->start += size;
+		if (iter->start == iter->end)
+		{
+			list_del(&iter->sibling);
+			kmem_cache_free(vm_range_cache, iter);
+		}
+
+		list_add(&range->sibling, vmalloc_busy_bucket(range->start));
+		return range;
+	}
+
+	return NULL;
+}
+
+static void vmalloc_free_range(struct vm_range *range)
+{
+	list_del(&range->sibling);
+
+	struct vm_range *iter;
+	list_for_each_entry(iter, &vmalloc_free_ranges, sibling)
+		if (iter->start >= range->end)
+			break;
+
+	// iter is the first free range after `range` (or the list head)
+	list_add_tail(&range->sibling, &iter->sibling);
+
+	if (&iter->sibling != &vmalloc_free_ranges && iter->start == range->end)
+	{
+		range->end = iter->end;
+		list_del(&iter->sibling);
+		kmem_cache_free(vm_range_cache, iter);
+	}
+
+	struct vm_range *prev = list_prev_entry(range, sibling);
+	if (&prev->sibling != &vmalloc_free_ranges && prev->end == range->start)
+	{
+		prev->end = range->end;
+		list_del(&range->sibling);
+		kmem_cache_free(vm_range_cache, range);
+	}
+}
+
+// NOTE: Each area is followed by an unmapped guard page so an overrun faults instead of
+// running into the next area. Pages are backed by individual frames, nothing here
+// needs physically contiguous memory
+void *vmalloc(size_t size)
+{
+	if (size == 0)
+		return NULL;
+
+	uint32_t pages = div_ceil(size, PMM_FRAME_SIZE);
+	struct vm_range *range = vmalloc_alloc_range((pages + 1) * PMM_FRAME_SIZE);
+	if (!range)
+		return NULL;
+
+	for (uint32_t i = 0; i < pages; ++i)
+	{
+		uint32_t vaddr = range->start + i * PMM_FRAME_SIZE;
+		uint32_t paddr = (uint32_t)pmm_alloc_block();
+		if (!paddr)
+		{
+			vmm_free_range(range->start, vaddr);
+			vmalloc_free_range(range);
+			return NULL;
+		}
+		vmm_map_address(vmm_get_directory(), vaddr, paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE);
+	}
+
+	return (void *)range->start;
+}
+
+void vfree(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	struct vm_range *range;
+	list_for_each_entry(range, vmalloc_busy_bucket((uint32_t)ptr), sibling)
+		if (range->start == (uint32_t)ptr)
+		{
+			vmm_free_range(range->start, range->end - PMM_FRAME_SIZE);
+			vmalloc_free_range(range);
+			return;
+		}
+
+	assert_not_reached();
+}
+
+static uint32_t ioremap_next = DEVICE_START;
+
+// NOTE: Device mappings live for the lifetime of the kernel, so the window is simply bumped.
+// Registers must not be cached, the returned pointer keeps the offset of paddr inside its page
+void *ioremap(uint32_t paddr, uint32_t size)
+{
+	uint32_t offset = paddr & (PMM_FRAME_SIZE - 1);
+	uint32_t pages = div_ceil(offset + size, PMM_FRAME_SIZE);
+
+	if (ioremap_next + pages * PMM_FRAME_SIZE > DEVICE_END)
+		return NULL;
+
+	uint32_t vaddr = ioremap_next;
+	ioremap_next += pages * PMM_FRAME_SIZE;
+
+	for (uint32_t i = 0; i < pages; ++i)
+		vmm_map_address(vmm_get_directory(), vaddr + i * PMM_FRAME_SIZE, (paddr - offset) + i * PMM_FRAME_SIZE,
+						I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_WRITETHOUGH | I86_PTE_NOT_CACHEABLE);
+
+	return (void *)(vaddr + offset);
+}
+
+// for a device that turned out to be unusable during probing, only the latest mapping returns its window
+void iounmap(void *addr, uint32_t size)
+{
+	uint32_t vaddr = (uint32_t)addr & PAGE_MASK;
+	uint32_t pages = div_ceil(((uint32_t)addr & (PMM_FRAME_SIZE - 1)) + size, PMM_FRAME_SIZE);
+
+	for (uint32_t i = 0; i < pages; ++i)
+		vmm_unmap_address(vmm_get_directory(), vaddr + i * PMM_FRAME_SIZE);
+
+	if (vaddr + pages * PMM_FRAME_SIZE == ioremap_next)
+		ioremap_next = vaddr;
+}
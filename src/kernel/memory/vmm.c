@@ -4,8 +4,13 @@
 #include <utils/debug.h>
 #include <utils/string.h>
 
+#include "rmap.h"
+
 #define PAGE_DIRECTORY_BASE 0xFFFFF000
 #define PAGE_TABLE_BASE 0xFFC00000
+#define PAGE_SCRATCH_BASE 0xFFBFF000
+#define VMM_FREE_BATCH 512
+#define VMM_FREE_RANGE_BATCH 64
 
 #define get_page_directory_index(x) (((x) >> 22) & 0x3ff)
 #define get_page_table_entry_index(x) (((x) >> 12) & 0x3ff)
@@ -22,6 +27,8 @@ void vmm_create_page_table(struct pdirectory *dir, uint32_t virt, uint32_t flags
 void vmm_paging(struct pdirectory *, uint32_t);
 
 static struct pdirectory *_current_dir;
+static uint32_t free_batch[VMM_FREE_BATCH];
+static uint32_t free_batch_count = 0;
 
 void vmm_flush_tlb_entry(uint32_t addr)
 {
@@ -34,7 +41,13 @@ void vmm_flush_tlb_entry(uint32_t addr)
   +-------------------------+ 0xFFFFFFFF
   | Page table mapping      |
   |_________________________| 0xFFC00000
+  | Scratch page            |
+  |_________________________| 0xFFBFF000
   |                         |
+  |-------------------------| 0xFC000000
+  | Kernel stacks           |
+  |-------------------------| 0xF8000000
+  | Slab pages              |
   |-------------------------| 0xF0000000
   |                         |
   | Device drivers          |
@@ -99,6 +112,7 @@ void vmm_alloc_ptable(struct pdirectory *va_dir, uint32_t index)
 		return;
 
 	uint32_t pa_table = (uint32_t)pmm_alloc_block();
+	memset((void *)(pa_table + KERNEL_HIGHER_HALF), 0, sizeof(struct ptable));
 	va_dir->m_entries[index] = pa_table | I86_PDE_PRESENT | I86_PDE_WRITABLE;
 }
 
@@ -169,11 +183,9 @@ uint32_t vmm_get_physical_address(uint32_t vaddr, bool is_page)
 
 struct pdirectory *vmm_create_address_space(struct pdirectory *current)
 {
-	char *aligned_object = kalign_heap(PMM_FRAME_SIZE);
 	// NOTE: MQ 2019-11-24 page directory, page table have to be aligned by 4096
-	struct pdirectory *va_dir = kcalloc(1, sizeof(struct pdirectory));
-	if (aligned_object)
-		kfree(aligned_object);
+	struct pdirectory *va_dir = vmalloc(sizeof(struct pdirectory));
+	memset(va_dir, 0, sizeof(struct pdirectory));
 
 	for (int i = 768; i < 1023; ++i)
 		va_dir->m_entries[i] = vmm_get_physical_address(PAGE_TABLE_BASE + i * PMM_FRAME_SIZE, true);
@@ -206,8 +218,7 @@ struct pdirectory *vmm_get_directory()
 */
 void vmm_map_address(struct pdirectory *va_dir, uint32_t virt, uint32_t phys, uint32_t flags)
 {
-	if (virt != PAGE_ALIGN(virt))
-		//dlog("0x%x is not page aligned", virt);
+	assert(virt == PAGE_ALIGN(virt));
 
 	if (!is_page_enabled(va_dir->m_entries[get_page_directory_index(virt)]))
 		vmm_create_page_table(va_dir, virt, flags);
@@ -215,6 +226,13 @@ void vmm_map_address(struct pdirectory *va_dir, uint32_t virt, uint32_t phys, ui
 	uint32_t *table = (uint32_t *)((char *)PAGE_TABLE_BASE + get_page_directory_index(virt) * PMM_FRAME_SIZE);
 	uint32_t tindex = get_page_table_entry_index(virt);
 
+	if (virt < KERNEL_HIGHER_HALF)
+	{
+		if (is_page_enabled(table[tindex]))
+			rmap_remove(get_aligned_address(table[tindex]), va_dir, virt);
+		rmap_add(get_aligned_address(phys), va_dir, virt);
+	}
+
 	table[tindex] = phys | flags;
 	vmm_flush_tlb_entry(virt);
 }
@@ -234,8 +252,7 @@ void vmm_create_page_table(struct pdirectory *va_dir, uint32_t virt, uint32_t fl
 
 void vmm_unmap_address(struct pdirectory *va_dir, uint32_t virt)
 {
-	if (virt != PAGE_ALIGN(virt))
-		//dlog("0x%x is not page aligned", virt);
+	assert(virt == PAGE_ALIGN(virt));
 
 	if (!is_page_enabled(va_dir->m_entries[get_page_directory_index(virt)]))
 		return;
@@ -246,6 +263,9 @@ void vmm_unmap_address(struct pdirectory *va_dir, uint32_t virt)
 	if (!is_page_enabled(pt->m_entries[pte]))
 		return;
 
+	if (virt < KERNEL_HIGHER_HALF)
+		rmap_remove(get_aligned_address(pt->m_entries[pte]), va_dir, virt);
+
 	pt->m_entries[pte] = 0;
 	vmm_flush_tlb_entry(virt);
 }
@@ -259,6 +279,30 @@ void vmm_unmap_range(struct pdirectory *va_dir, uint32_t vm_start, uint32_t vm_e
 		vmm_unmap_address(va_dir, addr);
 }
 
+// unmap every mapped page of the kernel range [start, end) and give the frames back to the pmm
+void vmm_free_range(uint32_t start, uint32_t end)
+{
+	uint32_t frames[VMM_FREE_RANGE_BATCH];
+	uint32_t count = 0;
+
+	for (uint32_t vaddr = start; vaddr < end; vaddr += PMM_FRAME_SIZE)
+	{
+		uint32_t pte = vmm_get_physical_address(vaddr, true);
+		if (!(pte & I86_PTE_PRESENT))
+			continue;
+
+		frames[count++] = pte & PAGE_MASK;
+		vmm_unmap_address(vmm_get_directory(), vaddr);
+
+		if (count == VMM_FREE_RANGE_BATCH)
+		{
+			pmm_free_blocks(frames, count);
+			count = 0;
+		}
+	}
+	pmm_free_blocks(frames, count);
+}
+
 struct pdirectory *vmm_fork(struct pdirectory *va_dir)
 {
 	struct pdirectory *forked_dir = vmm_create_address_space(va_dir);
@@ -294,6 +338,7 @@ struct pdirectory *vmm_fork(struct pdirectory *va_dir)
 					vmm_unmap_address(va_dir, (uint32_t)forked_pte);
 
 					forked_pt->m_entries[ipt] = forked_pte_paddr | I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER;
+					rmap_add(forked_pte_paddr, forked_dir, ipd * PAGES_PER_TABLE * PMM_FRAME_SIZE + ipt * PMM_FRAME_SIZE);
 				}
 			}
 			vmm_unmap_address(va_dir, (uint32_t)forked_pt);
@@ -303,4 +348,77 @@ struct pdirectory *vmm_fork(struct pdirectory *va_dir)
 	if (aligned_object)
 		kfree(aligned_object);
 	return forked_dir;
-}
\ No newline at end of file
+}
+
+// NOTE: When the frames were mapped by the current address space, stale tlb entries could still
+// reach them, so the tlb is flushed before the pmm may hand them out again
+static void vmm_flush_free_batch(bool flush_tlb)
+{
+	if (flush_tlb)
+		__asm__ __volatile__(
+			"mov %%cr3, %%eax \n"
+			"mov %%eax, %%cr3 \n" ::
+				: "eax", "memory");
+
+	pmm_free_blocks(free_batch, free_batch_count);
+	free_batch_count = 0;
+}
+
+static void vmm_queue_free_frame(uint32_t paddr, bool flush_tlb)
+{
+	free_batch[free_batch_count++] = paddr;
+	if (free_batch_count == VMM_FREE_BATCH)
+		vmm_flush_free_batch(flush_tlb);
+}
+
+// NOTE: Only page tables (not every user page) go through the scratch page, so tearing down
+// a non-current address space costs one invlpg per page table. For the current address space
+// the recursive mapping is used and the tlb is flushed via cr3 once per batch of freed frames
+void vmm_clear_user_space(struct pdirectory *va_dir)
+{
+	bool is_current = va_dir == vmm_get_directory();
+
+	for (int ipd = 0; ipd < 768; ++ipd)
+	{
+		pd_entry pde = va_dir->m_entries[ipd];
+		if (!is_page_enabled(pde))
+			continue;
+
+		struct ptable *pt;
+		if (is_current)
+			pt = (struct ptable *)(PAGE_TABLE_BASE + ipd * PMM_FRAME_SIZE);
+		else
+		{
+			vmm_map_address(vmm_get_directory(), PAGE_SCRATCH_BASE, get_aligned_address(pde), I86_PTE_PRESENT | I86_PTE_WRITABLE);
+			pt = (struct ptable *)PAGE_SCRATCH_BASE;
+		}
+
+		// frames which are still mapped by another address space stay alive.
+		// Entries are unlinked before their frame is queued, a batch can be released mid-walk
+		for (int ipt = 0; ipt < PAGES_PER_TABLE; ++ipt)
+			if (is_page_enabled(pt->m_entries[ipt]))
+			{
+				uint32_t frame = get_aligned_address(pt->m_entries[ipt]);
+				uint32_t vaddr = ipd * PAGES_PER_TABLE * PMM_FRAME_SIZE + ipt * PMM_FRAME_SIZE;
+				pt->m_entries[ipt] = 0;
+				if (!rmap_remove(frame, va_dir, vaddr))
+					vmm_queue_free_frame(frame, is_current);
+			}
+
+		va_dir->m_entries[ipd] = 0;
+		vmm_queue_free_frame(get_aligned_address(pde), is_current);
+	}
+
+	if (!is_current)
+		vmm_unmap_address(vmm_get_directory(), PAGE_SCRATCH_BASE);
+
+	vmm_flush_free_batch(is_current);
+}
+
+void vmm_destroy_address_space(struct pdirectory *va_dir)
+{
+	assert(va_dir != vmm_get_directory());
+
+	vmm_clear_user_space(va_dir);
+	vfree(va_dir);
+}
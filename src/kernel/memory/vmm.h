@@ -7,9 +7,17 @@
 #include "kernel_info.h"
 #include "pmm.h"
 
-#define KERNEL_HEAP_TOP 0xF0000000
+#define KERNEL_HEAP_TOP 0xE0000000
 #define KERNEL_HEAP_BOTTOM 0xD0000000
 #define USER_HEAP_TOP 0x40000000
+#define VMALLOC_END 0xE8000000
+#define VMALLOC_START 0xE0000000
+#define DEVICE_END 0xF0000000
+#define DEVICE_START 0xE8000000
+#define KERNEL_STACK_TOP 0xFC000000
+#define KERNEL_STACK_BOTTOM 0xF8000000
+#define KERNEL_SLAB_TOP 0xF8000000
+#define KERNEL_SLAB_BOTTOM 0xF0000000
 
 struct vm_area_struct;
 struct mm_struct;
@@ -85,18 +93,56 @@ struct pdirectory *vmm_get_directory();
 void vmm_map_address(struct pdirectory *dir, uint32_t virt, uint32_t phys, uint32_t flags);
 void vmm_unmap_address(struct pdirectory *va_dir, uint32_t virt);
 void vmm_unmap_range(struct pdirectory *va_dir, uint32_t vm_start, uint32_t vm_end);
-void *create_kernel_stack(int32_t blocks);
+void vmm_free_range(uint32_t start, uint32_t end);
 struct pdirectory *vmm_create_address_space(struct pdirectory *dir);
 uint32_t vmm_get_physical_address(uint32_t vaddr, bool is_page);
 struct pdirectory *vmm_fork(struct pdirectory *va_dir);
+void vmm_clear_user_space(struct pdirectory *va_dir);
+void vmm_destroy_address_space(struct pdirectory *va_dir);
 
 // malloc.c
+#define GFP_KERNEL 0x0
+#define GFP_ZERO 0x1
+#define GFP_ATOMIC 0x2
+
 void *sbrk(size_t n);
+void sbrk_trim(size_t n);
+bool sbrk_populate_pages(uint32_t start, uint32_t end);
+void *kmalloc_flags(size_t n, uint32_t flags);
 void *kmalloc(size_t n);
 void *kcalloc(size_t n, size_t size);
 void *krealloc(void *ptr, size_t size);
 void kfree(void *ptr);
 void *kalign_heap(size_t size);
+void kmalloc_init();
+
+struct kmalloc_stats
+{
+	uint32_t heap_size;
+	uint32_t used_bytes;
+	uint32_t used_blocks;
+	uint32_t free_bytes;
+	uint32_t free_blocks;
+	uint32_t largest_free;
+	uint32_t cached_bytes;	// parked in magazines, neither used nor free
+	uint32_t cached_blocks;
+};
+
+void kmalloc_get_stats(struct kmalloc_stats *stats);
+
+// kstack.c
+#define KERNEL_STACK_BLOCKS 4
+#define KERNEL_STACK_MAX_BLOCKS 15
+
+void *create_kernel_stack(int32_t blocks);
+void free_kernel_stack(void *stack);
+
+// vmalloc.c
+void vmalloc_init();
+void *vmalloc(size_t size);
+void vfree(void *ptr);
+void *ioremap(uint32_t paddr, uint32_t size);
+void iounmap(void *addr, uint32_t size);
 
 // mmap.c
 struct vm_area_struct *get_unmapped_area(uint32_t addr, uint32_t len);
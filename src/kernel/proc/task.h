@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cpu/fpu.h>
 #include <cpu/idt.h>
+#include <cpu/timer.h>
 #include <include/list.h>
 
 enum thread_state
@@ -32,6 +34,7 @@ struct thread
 	uint32_t kernel_stack;
 	uint32_t user_stack;
 	struct interrupt_registers uregs;
+	struct fpu_state *fpu;	// saved lazily, see fpu.c
 
 	sigset_t pending;
 	sigset_t blocked;
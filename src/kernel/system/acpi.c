@@ -0,0 +1,111 @@
+#include "acpi.h"
+
+#include <memory/vmm.h>
+#include <stddef.h>
+#include <utils/debug.h>
+
+#define ACPI_MAX_TABLES 32
+
+static struct acpi_sdt_header *tables[ACPI_MAX_TABLES];
+static uint32_t tables_count;
+
+static bool acpi_checksum(void *table, uint32_t length)
+{
+	uint8_t sum = 0;
+	for (uint32_t i = 0; i < length; ++i)
+		sum += ((uint8_t *)table)[i];
+	return sum == 0;
+}
+
+static bool acpi_signature_match(const char *a, const char *b)
+{
+	for (int i = 0; i < 4; ++i)
+		if (a[i] != b[i])
+			return false;
+	return true;
+}
+
+// NOTE: Firmware tables can be anywhere in physical memory, so they are mapped through the
+// device window. The header is mapped first to learn how long the table is
+static struct acpi_sdt_header *acpi_map_table(uint32_t paddr)
+{
+	struct acpi_sdt_header *header = ioremap(paddr, sizeof(struct acpi_sdt_header));
+	if (!header)
+		return NULL;
+
+	uint32_t length = header->length;
+	if (length > PMM_FRAME_SIZE - (paddr & (PMM_FRAME_SIZE - 1)))
+		header = ioremap(paddr, length);
+
+	if (!header || !acpi_checksum(header, length))
+		return NULL;
+	return header;
+}
+
+// all tables are mapped once at boot, lookups only walk the cached headers
+static void acpi_map_tables(struct acpi_sdt_header *root, bool is_xsdt)
+{
+	uint32_t entry_size = is_xsdt ? sizeof(uint64_t) : sizeof(uint32_t);
+	uint32_t entries = (root->length - sizeof(struct acpi_sdt_header)) / entry_size;
+	uint8_t *base = (uint8_t *)(root + 1);
+
+	for (uint32_t i = 0; i < entries && tables_count < ACPI_MAX_TABLES; ++i)
+	{
+		uint64_t paddr = is_xsdt ? *(uint64_t *)(base + i * entry_size) : *(uint32_t *)(base + i * entry_size);
+		if (paddr >> 32)
+			continue;
+
+		struct acpi_sdt_header *table = acpi_map_table(paddr);
+		if (table)
+			tables[tables_count++] = table;
+	}
+}
+
+void acpi_init(struct multiboot_tag *rsdp_tag)
+{
+	serial_write("ACPI: Initializing\n");
+
+	if (!rsdp_tag)
+	{
+		serial_write("ACPI: No RSDP from bootloader\n");
+		return;
+	}
+
+	struct acpi_rsdp *rsdp = (struct acpi_rsdp *)((struct multiboot_tag_new_acpi *)rsdp_tag)->rsdp;
+	struct acpi_sdt_header *root = NULL;
+	bool is_xsdt = false;
+
+	// the acpi 1.0 part has its own checksum, the extended checksum covers the whole structure
+	if (!acpi_checksum(rsdp, offsetof(struct acpi_rsdp, length)))
+	{
+		serial_write("ACPI: Invalid RSDP checksum\n");
+		return;
+	}
+
+	// on i686 the xsdt is only usable when it is below 4GiB
+	if (rsdp_tag->type == MULTIBOOT_TAG_TYPE_ACPI_NEW && rsdp->revision >= 2 &&
+		acpi_checksum(rsdp, sizeof(struct acpi_rsdp)) &&
+		rsdp->xsdt_address && !(rsdp->xsdt_address >> 32))
+	{
+		root = acpi_map_table(rsdp->xsdt_address);
+		is_xsdt = root != NULL;
+	}
+	if (!root)
+		root = acpi_map_table(rsdp->rsdt_address);
+
+	if (root)
+		acpi_map_tables(root, is_xsdt);
+	else
+		serial_write("ACPI: Invalid root table\n");
+
+	serial_write("ACPI: Done\n");
+}
+
+struct acpi_sdt_header *acpi_find_table(const char *signature)
+{
+	for (uint32_t i = 0; i < tables_count; ++i)
+		if (acpi_signature_match(tables[i]->signature, signature))
+			return tables[i];
+
+	return NULL;
+}
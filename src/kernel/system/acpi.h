@@ -0,0 +1,106 @@
+#ifndef SYSTEM_ACPI_H
+#define SYSTEM_ACPI_H
+
+#include <multiboot2.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct __attribute__((packed)) acpi_rsdp
+{
+	char signature[8];
+	uint8_t checksum;
+	char oem_id[6];
+	uint8_t revision;
+	uint32_t rsdt_address;
+	// revision >= 2
+	uint32_t length;
+	uint64_t xsdt_address;
+	uint8_t extended_checksum;
+	uint8_t reserved[3];
+};
+
+struct __attribute__((packed)) acpi_sdt_header
+{
+	char signature[4];
+	uint32_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+};
+
+struct __attribute__((packed)) acpi_generic_address
+{
+	uint8_t address_space;
+	uint8_t bit_width;
+	uint8_t bit_offset;
+	uint8_t access_size;
+	uint64_t address;
+};
+
+#define ACPI_MADT_LAPIC 0
+#define ACPI_MADT_IOAPIC 1
+#define ACPI_MADT_INTERRUPT_OVERRIDE 2
+#define ACPI_MADT_LAPIC_ADDRESS_OVERRIDE 5
+
+#define ACPI_MADT_POLARITY_MASK 0x3
+#define ACPI_MADT_POLARITY_ACTIVE_LOW 0x3
+#define ACPI_MADT_TRIGGER_MASK 0xc
+#define ACPI_MADT_TRIGGER_LEVEL 0xc
+
+struct __attribute__((packed)) acpi_madt
+{
+	struct acpi_sdt_header header;
+	uint32_t lapic_address;
+	uint32_t flags;
+	uint8_t entries[];
+};
+
+struct __attribute__((packed)) acpi_madt_entry
+{
+	uint8_t type;
+	uint8_t length;
+};
+
+struct __attribute__((packed)) acpi_madt_ioapic
+{
+	struct acpi_madt_entry header;
+	uint8_t id;
+	uint8_t reserved;
+	uint32_t address;
+	uint32_t gsi_base;
+};
+
+struct __attribute__((packed)) acpi_madt_interrupt_override
+{
+	struct acpi_madt_entry header;
+	uint8_t bus;
+	uint8_t source;
+	uint32_t gsi;
+	uint16_t flags;
+};
+
+struct __attribute__((packed)) acpi_madt_lapic_address_override
+{
+	struct acpi_madt_entry header;
+	uint16_t reserved;
+	uint64_t address;
+};
+
+struct __attribute__((packed)) acpi_hpet
+{
+	struct acpi_sdt_header header;
+	uint32_t event_timer_block_id;
+	struct acpi_generic_address address;
+	uint8_t hpet_number;
+	uint16_t minimum_tick;
+	uint8_t page_protection;
+};
+
+void acpi_init(struct multiboot_tag *rsdp_tag);
+struct acpi_sdt_header *acpi_find_table(const char *signature);
+
+#endif
@@ -62,4 +62,26 @@
 #define round(x, y) ({__auto_type _x = (x); __auto_type _y = (y); (_x / _y) * _y ; })
 #define abs(x) ({__auto_type _x = (x); _x >=0 ? _x : -_x; })
 
+// NOTE: A plain 64-bit division pulls in __udivdi3 from libgcc which we don't link against.
+// Two 32-bit divl do the job as long as the divisor fits in 32 bits
+static inline uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t *remainder)
+{
+	uint32_t high = dividend >> 32;
+	uint32_t quotient_high = high / divisor;
+	uint32_t quotient_low, rem = high % divisor;
+
+	asm("divl %4"
+		: "=a"(quotient_low), "=d"(rem)
+		: "a"((uint32_t)dividend), "d"(rem), "rm"(divisor));
+
+	if (remainder)
+		*remainder = rem;
+	return ((uint64_t)quotient_high << 32) | quotient_low;
+}
+
+static inline uint64_t div_u64(uint64_t dividend, uint32_t divisor)
+{
+	return div_u64_rem(dividend, divisor, 0);
+}
+
 #endif
\ No newline at end of file